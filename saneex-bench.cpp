@@ -0,0 +1,256 @@
+/* saneex-bench.cpp - C++ Exceptions Baseline For saneex-bench.c
+   by Proger_XP | https://github.com/ProgerXP/SaneC | public domain (CC0) */
+
+/*
+  C++ exceptions baseline for saneex-bench.c (see there for usage). Each case
+  mirrors the saneex one of the same name:
+
+    try..finally    - a destructor of a local object (RAII)
+    defer-5         - five such objects
+    rethrow         - catch (...) and throw a new exception of the same kind
+    catch-chain-40  - 40 catch clauses of distinct types, the last matches
+    catch-40        - catch (int) and a switch
+    throw-printf    - std::runtime_error with a snprintf()'d message
+    throw-printf-num  the same with only numbers in the message
+    throw-extra     - an exception carrying a new'ed payload
+    throw-attach    - an exception object carrying a value
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <stdexcept>
+
+static int json;
+
+static double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, void func(long), long iterations) {
+  if (iterations < 1) { iterations = 1; }
+  double start = now();
+  func(iterations);
+  double ns = (now() - start) / iterations;
+
+  if (json) {
+    printf("{\"impl\":\"c++\",\"case\":\"%s\",\"ns\":%.2f,"
+           "\"iterations\":%ld}\n", name, ns, iterations);
+  } else {
+    printf("%-24s %10.2f ns/op\n", name, ns);
+  }
+}
+
+static volatile int sink;
+
+struct Finally {
+  ~Finally() { sink++; }
+};
+
+struct WithPayload : std::runtime_error {
+  std::unique_ptr<long> payload;
+  WithPayload(long *p) : std::runtime_error("With payload"), payload(p) { }
+};
+
+static void tryEndtry(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      sink++;
+    } catch (...) {
+      throw;
+    }
+  }
+}
+
+static void tryFinally(long n) {
+  for (long i = 0; i < n; i++) {
+    Finally f;
+    sink++;
+  }
+}
+
+static void defer5(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      Finally f1, f2, f3, f4, f5;
+    } catch (...) {
+    }
+  }
+}
+
+// Plain try..endtry levels have no C++ counterpart; a non-inlined frame with
+// a destructor to run is the closest equivalent.
+__attribute__ ((noinline)) static void nest(int depth) {
+  if (depth <= 1) {
+    throw std::runtime_error("");
+  }
+
+  Finally f;
+  nest(depth - 1);
+}
+
+static void throwUp(long n, int depth) {
+  for (long i = 0; i < n; i++) {
+    try {
+      nest(depth);
+    } catch (...) {
+      sink++;
+    }
+  }
+}
+
+static void throw1(long n)  { throwUp(n, 1); }
+static void throw5(long n)  { throwUp(n, 5); }
+static void throw50(long n) { throwUp(n, 50); }
+
+__attribute__ ((noinline)) static void nestRethrow(int depth) {
+  if (depth <= 1) {
+    throw std::runtime_error("bottom");
+  }
+
+  try {
+    nestRethrow(depth - 1);
+  } catch (...) {
+    throw std::runtime_error("rethrown");
+  }
+}
+
+static void rethrow5(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      nestRethrow(5);
+    } catch (...) {
+      sink++;
+    }
+  }
+}
+
+// leave() has no C++ equivalent; the nearest is throwing a plain int through
+// RAII frames.
+static void nestLeave(int depth) {
+  if (depth <= 1) {
+    throw 1;
+  }
+
+  Finally f;
+  nestLeave(depth - 1);
+}
+
+static void leave5(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      nestLeave(5);
+    } catch (int) {
+      sink++;
+    }
+  }
+}
+
+// 40 handlers, the exception matches the last one.
+template <int N> struct Code { };
+
+#define CATCH4(n) \
+  catch (Code<n>) { sink++; } catch (Code<n + 1>) { sink++; } \
+  catch (Code<n + 2>) { sink++; } catch (Code<n + 3>) { sink++; }
+
+static void catchChain40(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      throw Code<40>();
+    } CATCH4(1) CATCH4(5) CATCH4(9) CATCH4(13) CATCH4(17)
+      CATCH4(21) CATCH4(25) CATCH4(29) CATCH4(33) CATCH4(37)
+  }
+}
+
+// The nearest to catchswitch is catching an int and switching on it.
+static void catchSwitch40(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      throw 40;
+    } catch (int code) {
+      switch (code) {
+      case 1: case 2: case 3: sink--; break;
+      case 40: sink++; break;
+      }
+    }
+  }
+}
+
+static void throwPrintf(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      char buf[128];
+      snprintf(buf, sizeof(buf), "Item %ld is invalid: %s", i, "bad checksum");
+      throw std::runtime_error(buf);
+    } catch (...) {
+      sink++;
+    }
+  }
+}
+
+static void throwPrintfNum(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      char buf[128];
+      snprintf(buf, sizeof(buf), "Item %ld is invalid: checksum %08x", i, 0xbad);
+      throw std::runtime_error(buf);
+    } catch (...) {
+      sink++;
+    }
+  }
+}
+
+static void throwExtra(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      throw WithPayload(new long(i));
+    } catch (...) {
+      sink++;
+    }
+  }
+}
+
+struct WithValue {
+  long value;
+};
+
+static void throwAttach(long n) {
+  for (long i = 0; i < n; i++) {
+    try {
+      throw WithValue{i};
+    } catch (const WithValue &e) {
+      sink += e.value;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  long iterations = 1000000;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-j")) {
+      json = 1;
+    } else {
+      iterations = atol(argv[i]);
+    }
+  }
+
+  run("try-endtry",       tryEndtry,    iterations * 10);
+  run("try-finally",      tryFinally,   iterations * 10);
+  run("defer-5",          defer5,       iterations);
+  run("throw-catch-1",    throw1,       iterations);
+  run("throw-catch-5",    throw5,       iterations / 5);
+  run("throw-catch-50",   throw50,      iterations / 50);
+  run("rethrow-5",        rethrow5,     iterations / 5);
+  run("leave-5",          leave5,       iterations / 5);
+  run("catch-chain-40",   catchChain40, iterations);
+  run("catch-40",         catchSwitch40, iterations);
+  run("throw-printf",     throwPrintf,  iterations);
+  run("throw-printf-num", throwPrintfNum, iterations);
+  run("throw-extra",      throwExtra,   iterations);
+  run("throw-attach",     throwAttach,  iterations);
+}
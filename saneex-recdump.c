@@ -0,0 +1,60 @@
+/* saneex-recdump.c - A try..catch Implementation In Plain C (C99)
+   by Proger_XP | https://github.com/ProgerXP/SaneC | public domain (CC0) */
+
+/*
+  Prints rings that saneex has written with SX_RECORDER and sxRecorderPath
+  (e.g. after a crash) in the SX_VERBOSE format, the oldest event first:
+
+  gcc -Wall -Wextra saneex-recdump.c saneex.c -o saneex-recdump
+  ./saneex-recdump /tmp/myapp.rec.1234.0 [more files...]
+
+  With several files each is preceded by its name. Exit code is 1 if any
+  file couldn't be read or isn't a ring.
+*/
+
+#include "saneex.h"
+
+// Returns file's contents (malloc()'ed) or NULL.
+static void *readAll(const char *path, long *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) { return NULL; }
+  char *buf = NULL;
+
+  if (!fseek(f, 0, SEEK_END) && (*size = ftell(f)) > 0 &&
+      !fseek(f, 0, SEEK_SET) && (buf = malloc(*size)) &&
+      fread(buf, 1, *size, f) != (size_t) *size) {
+    free(buf);
+    buf = NULL;
+  }
+
+  fclose(f);
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  int status = 0;
+
+  for (int i = 1; i < argc; i++) {
+    long size;
+    struct SxRecorder *rec = readAll(argv[i], &size);
+
+    if (argc > 2) {
+      printf("%s== %s\n", i > 1 ? "\n" : "", argv[i]);
+    }
+
+    if (!rec) {
+      fprintf(stderr, "%s: cannot read\n", argv[i]);
+      status = 1;
+    } else if ((size_t) size < sizeof(*rec) ||
+               (size_t) size < sizeof(*rec) + (size_t) rec->capacity *
+                               sizeof(rec->events[0]) ||
+               sxPrintRecorder(rec, stdout) < 0) {
+      fprintf(stderr, "%s: not a saneex recorder file\n", argv[i]);
+      status = 1;
+    }
+
+    free(rec);
+  }
+
+  return status;
+}
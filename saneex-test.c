@@ -10,11 +10,33 @@
 
   Else you can use the included glib.h stub:
   gcc -Wall -Wextra saneex-test.c saneex.c -I.
+
+  Add -DSX_INLINE to test the inlined try..catch functions,
+  -DSX_THREAD_LOCAL=_Thread_local to test freeing of thread's state,
+  -DSX_DEFER_ARGS=8 to test deferred sxprintf() formatting,
+  -DSX_TELEMETRY to test sxTelemetrySnapshot(),
+  -DSX_RECORDER to test sxThreadRecorder(),
+  -DSX_FAULTS to test sxCatchFaults() and
+  -DSX_BACKTRACE=16 -fno-omit-frame-pointer to test sxCurrentBacktrace().
 */
 
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <wchar.h>
 #include <glib.h>
 #include "saneex.h"
 
+#if SX_THREAD_EXIT
+#include <threads.h>
+#endif
+
+#ifdef SX_FAULTS
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
 #define START   \
   char trace[11] = "\0\0\0\0\0" "\0\0\0\0\0" "\1"
 
@@ -284,30 +306,1549 @@ void test_case111F(void) {
   END(tcf!);
 }
 
-int main(int argc, char **argv) {
-  g_test_init(&argc, &argv, NULL);
+// Nesting deeper than one context segment (SX_TRY_SEGMENT).
+static void nest(int depth, volatile int *finallies) {
+  try {
+    if (depth > 0) {
+      nest(depth - 1, finallies);
+    } else {
+      throw(msgex("bottom"));
+    }
+  } finally {
+    ++*finallies;
+  } endtry
+}
 
-  // (f)inally, (F) with exception
+void test_deep(void) {
+  for (volatile int round = 0; round < 2; round++) {   // second round reuses segments.
+    volatile int finallies = 0;
+    volatile int caught = 0;
 
-  g_test_add_func("/TE/case000",      test_case000);
-  g_test_add_func("/TE/case000f",     test_case000f);
-  g_test_add_func("/TE/case000F",     test_case000F);
+    try {
+      nest(300, &finallies);
+    } catchall {
+      caught++;
+    } endtry
 
-  g_test_add_func("/TCE/case010",     test_case010);
-  g_test_add_func("/TCE/case010f",    test_case010f);
-  g_test_add_func("/TCE/case010F",    test_case010F);
+    g_assert_true(caught == 1);
+    g_assert_true(finallies == 301);
+  }
+}
 
-  g_test_add_func("/T!E/case100",     test_case100);
-  g_test_add_func("/T!E/case100f",    test_case100f);
-  g_test_add_func("/T!E/case100F",    test_case100F);
+static void collect(const struct SxTraceEntry *entry, void *data) {
+  struct SxTraceEntry *entries = data;
+  while (entries->file) { entries++; }
+  *entries = *entry;
+}
 
-  g_test_add_func("/T!CE/case110",    test_case110);
-  g_test_add_func("/T!CE/case110f",   test_case110f);
-  g_test_add_func("/T!CE/case110F",   test_case110F);
+// Static messages are kept by pointer, formatted ones are copied to the trace.
+void test_message(void) {
+  static const char *literal = "literal";
 
-  g_test_add_func("/T!C!E/case111",   test_case111);
-  g_test_add_func("/T!C!E/case111f",  test_case111f);
-  g_test_add_func("/T!C!E/case111F",  test_case111F);
+  try {
+    try {
+      throw(msgex(literal));
+    } catchall {
+      g_assert_true(curex().message == literal);
+      rethrow(sxprintf(newex(), "formatted %d", 123));
+    } endtry
+  } catchall {
+    struct SxTraceEntry entries[4] = {{0}};
+
+    g_assert_true(sxWalkTrace(collect, entries) == 3);
+    g_assert_cmpstr(entries[0].message, ==, "literal");
+    g_assert_cmpstr(entries[1].message, ==, "formatted 123");
+    g_assert_cmpstr(entries[2].message, ==, "rethrown by ENDTRY");
+    g_assert_cmpstr(entries[2].file, ==, __FILE__);
+  } endtry
+}
+
+// Pointer-based API works on the same trace as the by-value one.
+void test_pointers(void) {
+  try {
+    try {
+      struct SxTraceEntry entry = newex();
+      entry.code = 7;
+      throwp(sxprintfp(&entry, "item %d", 5));
+    } catch(7) {
+      g_assert_cmpstr(curexp()->message, ==, "item 5");
+      g_assert_true(curexp()->code == 7);
+      rethrowp(curexp());
+    } endtry
+  } catch(7) {
+    struct SxTraceEntry entries[4] = {{0}};
+    g_assert_true(sxWalkTrace(collect, entries) == 3);
+    g_assert_cmpstr(curex().message, ==, "item 5");
+    // Re-throwing the current entry as a new exception keeps its text.
+    try {
+      throwp(curexp());
+    } catchall {
+      g_assert_cmpstr(curexp()->message, ==, "item 5");
+    } endtry
+  } endtry
+}
+
+// Nests plain try..endtry blocks, with a finally in the middle one.
+static void plain(int depth, int finallyAt, volatile int *finallies) {
+  if (depth == 0) {
+    throw(msgex("bottom"));
+  } else if (depth == finallyAt) {
+    try {
+      plain(depth - 1, finallyAt, finallies);
+    } finally {
+      ++*finallies;
+    } endtry
+  } else {
+    try {
+      plain(depth - 1, finallyAt, finallies);
+    } endtry
+  }
+}
+
+// Tries without catch and finally don't add trace entries but are counted;
+// the second round skips them altogether.
+void test_passed(void) {
+  for (volatile int round = 0; round < 2; round++) {
+    volatile int finallies = 0;
+
+    try {
+      plain(21, 11, &finallies);
+    } catchall {
+      struct SxTraceEntry entries[4] = {{0}};
+
+      g_assert_true(sxWalkTrace(collect, entries) == 2);
+      g_assert_cmpstr(entries[0].message, ==, "bottom");
+      g_assert_true(entries[0].passed == 10);
+      g_assert_cmpstr(entries[1].message, ==, "rethrown by ENDTRY");
+      g_assert_true(entries[1].passed == 10);
+    } endtry
+
+    g_assert_true(finallies == 1);
+  }
+}
+
+// Numeric-only sxprintf() is formatted when the message is read, the same way
+// snprintf() would.
+void test_deferred(void) {
+  static const char *fmt = "%d|%-5ld|%zu|%p|%%|%#06x|%.2f|%c|%hhd|%lld|%+e";
+  char expected[SX_MAX_TRACE_STRING];
+  snprintf(expected, sizeof(expected), fmt, -1, 2L, (size_t) 3, (void *) fmt,
+    255, 1.5, 'c', 4, -5LL, 6.0);
+
+  struct SxTraceEntry e = sxprintf(newex(), fmt, -1, 2L, (size_t) 3,
+    (void *) fmt, 255, 1.5, 'c', 4, -5LL, 6.0);
+  g_assert_cmpstr(sxMessage(&e), ==, expected);
+
+  e = sxprintf(newex(), "%s %d", "eager", 1);
+  g_assert_cmpstr(e.message, ==, "eager 1");
+
+#if !SX_DEFER_ARGS
+  // fmt is only kept by pointer if SX_DEFER_ARGS is set.
+  char runtime[8];
+  strcpy(runtime, "%d");
+  e = sxprintf(newex(), runtime, 1);
+  strcpy(runtime, "%d!");
+  g_assert_cmpstr(sxMessage(&e), ==, "1");
+#endif
+
+  e = sxprintf(newex(), "%lc %d", (wint_t) 'w', 2);
+  g_assert_cmpstr(e.message, ==, "w 2");
+
+  // A character that can't be encoded fails the whole message.
+  e = sxprintf(newex(), "%d %lc", 3, (wint_t) 0xd800);
+  g_assert_cmpstr(sxMessage(&e), ==, "");
+
+  // Truncated like snprintf().
+  char long_[SX_MAX_TRACE_STRING * 2];
+  memset(long_, 'x', sizeof(long_) - 1);
+  long_[sizeof(long_) - 1] = '\0';
+  strcpy(long_ + SX_MAX_TRACE_STRING - 10, "%d tail");
+  snprintf(expected, sizeof(expected), long_, 123456789);
+
+  try {
+    try {
+      throw(sxprintf(newex(), "thrown %u", 7u));
+    } catchall {
+      g_assert_cmpstr(curexp()->message, ==, "thrown 7");
+      rethrow(sxprintf(newex(), long_, 123456789));
+    } endtry
+  } catchall {
+    struct SxTraceEntry entries[4] = {{0}};
+    g_assert_true(sxWalkTrace(collect, entries) == 3);
+    g_assert_cmpstr(entries[1].message, ==, expected);
+  } endtry
+}
+
+struct Small {
+  int a;
+  double b;
+};
+
+struct Large {
+  char bytes[SX_MAX_PAYLOAD + 1];
+};
+
+static int delSum;
+
+static void delCounted(void *extra) {
+  delSum += *(int *) extra;
+}
+
+// sxAttach()'ed payloads travel with the trace; pool blocks are reused.
+void test_attach(void) {
+  void *volatile block = NULL;
+
+  for (volatile int round = 0; round < 2; round++) {
+    try {
+      try {
+        struct SxTraceEntry e = msgex("small");
+        struct Small *small = sxAttach(&e, sizeof(*small));
+        small->a = 1;
+        small->b = 2.5;
+        throw(e);
+      } catchall {
+        g_assert_true(curextra(struct Small)->a == 1);
+        g_assert_true(curextra(struct Small)->b == 2.5);
+        g_assert_true(curextra(struct Large) == NULL);
+
+        struct SxTraceEntry e = msgex("large");
+        struct Large *large = sxAttach(&e, sizeof(*large));
+        g_assert_true(round == 0 || large == block);
+        block = large;
+        large->bytes[SX_MAX_PAYLOAD] = 'L';
+        rethrow(e);
+      } endtry
+    } catchall {
+      struct SxTraceEntry entries[4] = {{0}};
+      g_assert_true(sxWalkTrace(collect, entries) == 3);
+      g_assert_true(((struct Small *) entries[0].extra)->a == 1);
+      g_assert_true(entries[1].extra == block);
+      g_assert_true(curextra(struct Large) == NULL);
+      g_assert_true(((struct Large *) entries[1].extra)->bytes[SX_MAX_PAYLOAD]
+        == 'L');
+    } endtry
+  }
+
+  // An inline payload of a rethrown entry is shared, not copied.
+  try {
+    try {
+      struct SxTraceEntry e = msgex("inline");
+      *(int *) sxAttach(&e, sizeof(int)) = 9;
+      throw(e);
+    } catchall {
+      rethrow(curex());
+    } endtry
+  } catchall {
+    struct SxTraceEntry entries[4] = {{0}};
+    g_assert_true(sxWalkTrace(collect, entries) == 3);
+    g_assert_true(entries[1].extra == entries[0].extra);
+    g_assert_true(*(int *) entries[1].extra == 9);
+  } endtry
+
+  // extraDel is called with the payload (after it was moved into the trace)
+  // when the trace is cleared.
+  try {
+    try {
+      struct SxTraceEntry e = msgex("with del");
+      *(int *) sxAttach(&e, sizeof(int)) = 5;
+      e.extraDel = delCounted;
+      throw(e);
+    } catchall {
+      g_assert_true(delSum == 0);
+      throw(newex());
+    } endtry
+  } catchall {
+    g_assert_true(delSum == 5);
+  } endtry
+
+  // And right away if the trace is full; a pool block is reused then too.
+  try {
+    try {
+      errno = 3;
+      throw(newex());
+    } catchall {
+      for (int i = 1; i < SX_MAX_TRACE; i++) { sxAddTraceEntry(newex()); }
+      struct SxTraceEntry e = msgex("dropped");
+      struct Large *large = sxAttach(&e, sizeof(*large));
+      block = large;
+      *(int *) large = 7;
+      e.extraDel = delCounted;
+      rethrow(e);
+    } endtry
+  } catchall {
+    g_assert_true(delSum == 5 + 7);
+
+    try {
+      struct SxTraceEntry e = msgex("reused");
+      g_assert_true(sxAttach(&e, sizeof(struct Large)) == block);
+      throw(e);
+    } catchall {
+    } endtry
+  } endtry
+
+  // A payload shared by a rethrown entry is released once.
+  for (volatile int round = 0; round < 2; round++) {
+    try {
+      try {
+        struct SxTraceEntry e = msgex("rethrown");
+        *(int *) sxAttach(&e, sizeof(struct Large)) = 11;
+        e.extraDel = delCounted;
+        throw(e);
+      } catchall {
+        if (round) { rethrowp(curexp()); } else { rethrow(curex()); }
+      } endtry
+    } catchall {
+      g_assert_true(*(int *) curextra(struct Large) == 11);
+    } endtry
+
+    void *volatile first = NULL;
+
+    try {
+      try {
+        struct SxTraceEntry e = msgex("first");
+        first = sxAttach(&e, sizeof(struct Large));
+        throw(e);
+      } catchall {
+        g_assert_true(delSum == 5 + 7 + 11 * (round + 1));
+        struct SxTraceEntry e = msgex("second");
+        g_assert_true(sxAttach(&e, sizeof(struct Large)) != first);
+        rethrow(e);
+      } endtry
+    } catchall {
+    } endtry
+  }
+
+  // Same when the trace is full and the rethrown copy is dropped.
+  try {
+    try {
+      struct SxTraceEntry e = msgex("full");
+      *(int *) sxAttach(&e, sizeof(struct Large)) = 13;
+      e.extraDel = delCounted;
+      throw(e);
+    } catchall {
+      for (int i = 1; i < SX_MAX_TRACE; i++) { sxAddTraceEntry(newex()); }
+      rethrow(curex());
+    } endtry
+  } catchall {
+    g_assert_true(*(int *) curextra(struct Large) == 13);
+  } endtry
+
+  try {
+    try {
+      struct SxTraceEntry e = msgex("first");
+      block = sxAttach(&e, sizeof(struct Large));
+      throw(e);
+    } catchall {
+      g_assert_true(delSum == 5 + 7 + 11 * 2 + 13);
+      struct SxTraceEntry e = msgex("second");
+      g_assert_true(sxAttach(&e, sizeof(struct Large)) != block);
+      rethrow(e);
+    } endtry
+  } catchall {
+  } endtry
+
+  // extraDel of a rethrown inline payload is called once too.
+  try {
+    try {
+      struct SxTraceEntry e = msgex("inline del");
+      *(int *) sxAttach(&e, sizeof(int)) = 17;
+      e.extraDel = delCounted;
+      throw(e);
+    } catchall {
+      rethrow(curex());
+    } endtry
+  } catchall {
+  } endtry
+
+  try {
+    throw(newex());
+  } catchall {
+    g_assert_true(delSum == 5 + 7 + 11 * 2 + 13 + 17);
+  } endtry
+
+  // throw(curex()) takes the payload over instead of releasing it with the
+  // old trace: a pool, a malloc() and an inline one.
+  for (volatile int round = 0; round < 3; round++) {
+    const int sum = delSum;
+
+    try {
+      try {
+        struct SxTraceEntry e = msgex("taken over");
+
+        if (round == 1) {
+          e = exex("taken over", malloc(sizeof(int)));
+        } else {
+          sxAttach(&e, round ? sizeof(int) : sizeof(struct Large));
+        }
+
+        *(int *) e.extra = 23;
+        e.extraDel = delCounted;
+        throw(e);
+      } catchall {
+        if (round == 1) { throw(curex()); } else { throwp(curexp()); }
+      } endtry
+    } catchall {
+      g_assert_true(delSum == sum);
+      g_assert_true(*(int *) curextra(int) == 23);
+    } endtry
+
+    try {
+      throw(newex());
+    } catchall {
+      g_assert_true(delSum == sum + 23);
+      struct SxTraceEntry a = msgex("a"), b = msgex("b");
+      g_assert_true(sxAttach(&a, sizeof(struct Large)) !=
+                    sxAttach(&b, sizeof(struct Large)));
+      sxDetach(&a);
+      sxDetach(&b);
+    } endtry
+  }
+
+  // sxDetach() releases a payload that isn't thrown.
+  struct SxTraceEntry e = msgex("unthrown");
+  block = sxAttach(&e, sizeof(struct Large));
+  *(int *) block = 19;
+  e.extraDel = delCounted;
+  sxDetach(&e);
+  g_assert_true(e.extra == NULL);
+  g_assert_true(delSum == 5 + 7 + 11 * 2 + 13 + 17 + 23 * 3 + 19);
+  g_assert_true(sxAttach(&e, sizeof(struct Large)) == block);
+  sxDetach(&e);
+  g_assert_true(delSum == 5 + 7 + 11 * 2 + 13 + 17 + 23 * 3 + 19);
+}
+
+static void descend(int depth, volatile int *finallies) {
+  if (depth == 0) {
+    leave(5);
+  }
+
+  try {
+    descend(depth - 1, finallies);
+  } catch(4) {
+    g_test_fail();
+  } finally {
+    ++*finallies;
+  } endtry
+}
+
+// leave() runs catch and finally blocks but leaves no trace and errno alone.
+void test_leave(void) {
+  volatile int finallies = 0;
+
+  try {
+    throw(msgex("previous"));
+  } catchall {
+    errno = 123;
+
+    try {
+      descend(3, &finallies);
+    } catch(5) {
+      g_assert_true(curex().code == -1);
+      g_assert_true(sxWalkTrace(collect, NULL) == 0);
+    } endtry
+  } endtry
+
+  g_assert_true(finallies == 3);
+  g_assert_true(errno == 123);
+
+  // A caught leave() can be rethrown as a regular exception.
+  try {
+    try {
+      leave(6);
+    } catch(6) {
+      struct SxTraceEntry e = msgex("from leave");
+      e.code = 6;
+      rethrowp(&e);
+    } endtry
+  } catch(6) {
+    g_assert_true(sxWalkTrace(collect, (struct SxTraceEntry[3]) {{0}}) == 2);
+  } endtry
+}
+
+static int dispatch(int code) {
+  volatile int result = 0;
+
+  try {
+    try {
+      errno = code;
+      throw(newex());
+    } catch(1) {
+      result = 1;
+    } catchswitch {
+      catchcase(2) {
+        result = 2;
+      }
+      catchcase(3) {
+        result = 3;
+        errno = 4;
+        throw(newex());
+      }
+      catchcase(4) {
+        g_test_fail();
+      }
+    } finally {
+      result *= 10;
+    } endtry
+  } catchswitch {
+    catchdefault {
+      result += curex().code * 100;
+    }
+  } endtry
+
+  return result;
+}
+
+// catchswitch behaves like a chain of catch() with the same caught/finally
+// rules: unmatched codes and throws from a case go up.
+void test_catchswitch(void) {
+  g_assert_true(dispatch(1) == 10);
+  g_assert_true(dispatch(2) == 20);
+  g_assert_true(dispatch(3) == 430);
+  g_assert_true(dispatch(5) == 500);
+}
+
+static struct SxResult find(int key, int *value) {
+  if (key < 0) {
+    return sxerr(404, "not found");
+  }
+
+  *value = key * 2;
+  return sxok();
+}
+
+static int findOrThrow(int key) {
+  int value;
+  thrres(find(key, &value));
+  return value;
+}
+
+// SxResult converts to an exception and back.
+void test_result(void) {
+  g_assert_true(findOrThrow(2) == 4);
+
+  try {
+    findOrThrow(-1);
+  } catch(404) {
+    g_assert_cmpstr(curex().message, ==, "not found");
+    g_assert_cmpstr(curex().file, ==, __FILE__);
+  } endtry
+
+  struct SxResult r;
+
+  capture(r) {
+    findOrThrow(2);
+  } endcapture
+
+  g_assert_true(r.code == 0);
+
+  capture(r) {
+    throw(sxprintf(msgex(""), "code %d", 7));
+  } endcapture
+
+  // msgex() takes errno as the code.
+  g_assert_true(r.code == (errno ? errno : 1));
+  g_assert_cmpstr(r.message, ==, "code 7");
+
+  capture(r) {
+    leave(9);
+  } endcapture
+
+  g_assert_true(r.code == 9);
+  g_assert_cmpstr(r.message, ==, "");
+}
+
+static char deferLog[200];
+
+static void logDefer(void *ptr) {
+  strcat(deferLog, ptr);
+}
+
+static void throwDefer(void *ptr) {
+  throw(msgex(ptr));
+}
+
+static void pushAndThrow(void) {
+  char local[2] = "c";
+  sxDefer(logDefer, local);     // still valid when called.
+  throw(msgex("thrown"));
+}
+
+// sxDefer() records run in reverse order when their try is left.
+void test_defer(void) {
+  deferLog[0] = '\0';
+  sxDefer(logDefer, "z");   // outside of the try - not run by it.
+
+  try {
+    sxDefer(logDefer, "a");
+    sxDefer(logDefer, "b");
+  } endtry
+
+  g_assert_cmpstr(deferLog, ==, "ba");
+
+  try {
+    sxDefer(logDefer, "a");
+    pushAndThrow();
+  } catchall {
+    strcat(deferLog, "C");
+  } finally {
+    strcat(deferLog, "F");
+  } endtry
+
+  g_assert_cmpstr(deferLog, ==, "bacaCF");
+
+  // Early pop, with and without calling.
+  int depth = sxDeferDepth();
+  sxDefer(logDefer, "d");
+  sxDefer(logDefer, "e");
+  sxUndefer(depth + 1, 0);
+  sxUndefer(depth, 1);
+  g_assert_cmpstr(deferLog, ==, "bacaCFd");
+
+  // A throwing record replaces the exception, others still run.
+  try {
+    sxDefer(logDefer, "g");
+    sxDefer(throwDefer, "replaced");
+    throw(msgex("original"));
+  } catchall {
+    g_assert_cmpstr(curex().message, ==, "replaced");
+  } endtry
+
+  g_assert_cmpstr(deferLog, ==, "bacaCFdg");
+
+  // More records than initially allocated.
+  deferLog[0] = '\0';
+
+  try {
+    for (int i = 0; i < 100; i++) {
+      sxDefer(logDefer, i % 2 ? "1" : "0");
+    }
+  } endtry
+
+  g_assert_true(strlen(deferLog) == 100 && deferLog[0] == '1');
+  g_assert_true(sxDeferDepth() == depth);
+  sxUndefer(depth - 1, 1);
+  g_assert_cmpstr(deferLog + 100, ==, "z");
+}
+
+// sxalloc() memory is released by the innermost endtry, however it's left.
+void test_region(void) {
+  char *outer = sxalloc(3);
+  strcpy(outer, "ok");
+  char *volatile first = NULL;
+
+  try {
+    first = sxalloc(100);
+    g_assert_true(((uintptr_t) first & 15) == 0);
+
+    try {
+      char *inner = sxalloc(1);
+      g_assert_true(inner == first + 112);
+      // Own chunk, then back to the same one.
+      memset(sxalloc(SX_REGION_CHUNK), 1, SX_REGION_CHUNK);
+      g_assert_true(sxalloc(1) != inner + 16);
+    } endtry
+
+    g_assert_true(sxalloc(1) == first + 112);
+  } endtry
+
+  g_assert_true(sxalloc(1) == first);   // not in a try - kept.
+
+  try {
+    try {
+      char *buf = sxalloc(8);
+      g_assert_true(buf == first + 16);
+      strcpy(buf, "thrown");
+      throw(msgex(buf));
+    } catchall {
+      g_assert_cmpstr(curex().message, ==, "thrown");   // still valid.
+    } endtry
+
+    g_assert_true(sxalloc(1) == first + 16);
+  } endtry
+
+  g_assert_cmpstr(outer, ==, "ok");
+
+  // Even 0 bytes from a region that has no chunk yet.
+  struct SxState *own = sxNewState();
+  struct SxState *prev = sxSwitchState(own);
+  char *zero = sxalloc(0);
+  g_assert_true(zero != NULL && sxalloc(0) == zero + 16);
+  sxSwitchState(prev);
+  sxFreeState(own);
+
+  // A size that can't be rounded up fails like malloc() would.
+  fflush(stdout);
+  const pid_t pid = fork();
+  g_assert_true(pid >= 0);
+
+  if (!pid) {
+    dup2(open("/dev/null", O_WRONLY), 2);
+    sxalloc((size_t) -8);
+    _exit(1);
+  }
+
+  int status;
+  g_assert_true(waitpid(pid, &status, 0) == pid);
+  g_assert_true(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_NO_MEMORY);
+}
+
+void test_state(void) {
+  struct SxState *a = sxNewState();
+  struct SxState *b = sxNewState();
+  struct SxState *own = sxSwitchState(a);
+  volatile int caught = 0;
+
+  try {
+    errno = 6;
+    throw(msgex("in a"));
+  } catch(6) {
+    // Like a fiber suspended in a catch while another one throws.
+    g_assert_true(sxSwitchState(b) == a);
+
+    try {
+      try {
+        errno = 5;
+        throw(msgex("in b"));
+      } endtry
+    } catch(5) {
+      g_assert_cmpstr(curex().message, ==, "in b");
+      sxalloc(SX_REGION_CHUNK * 2);
+      caught++;
+    } endtry
+
+    sxSwitchState(a);
+    g_assert_cmpstr(curex().message, ==, "in a");
+    g_assert_true(curex().passed == 0);
+    caught++;
+  } endtry
+
+  g_assert_true(caught == 2);
+  g_assert_true(sxSwitchState(NULL) == a);
+  g_assert_true(sxSwitchState(NULL) == own);
+  sxFreeState(a);
+  sxFreeState(b);
+}
+
+#ifdef SX_TELEMETRY
+static int throwLine;
+
+static void throwCounted(void) {
+  throwLine = __LINE__; throw(msgex("counted"));
+}
+
+void test_telemetry(void) {
+  struct SxSiteStats throwSites[64], catchSites[64];
+  struct SxTelemetry before = {.throwSites = throwSites, .maxThrowSites = 64,
+                               .catchSites = catchSites, .maxCatchSites = 64};
+  sxTelemetrySnapshot(&before);
+  // Catches are counted by endtry's line.
+  const int catchLine = __LINE__ + 9;
+
+  for (volatile int round = 0; round < 3; round++) {
+    try {
+      try {
+        throwCounted();
+      } finally {
+      } endtry              // not counted - rethrows.
+    } catchall {
+    } endtry
+  }
+
+  try {
+    leave(1);
+  } catch(1) {
+  } endtry
+
+  // The same file name at another address is the same site.
+  static char fileCopy[256];
+  g_assert_true(sxlcpyn(fileCopy, __FILE__, sizeof(fileCopy)) != NULL);
+
+  try {
+    struct SxTraceEntry e = msgex("copied");
+    e.file = fileCopy;
+    e.line = throwLine;
+    throw(e);
+  } catchall {
+  } endtry
+
+  struct SxTelemetry after = before;
+  sxTelemetrySnapshot(&after);
+  g_assert_true(after.throws - before.throws == 4);
+  g_assert_true(after.catches - before.catches == 4);
+
+  unsigned long histogram = 0;
+
+  for (int i = 0; i < SX_HISTOGRAM; i++) {
+    histogram += after.histogram[i];
+  }
+
+  g_assert_true(histogram == after.catches);
+  int found = 0;
+
+  for (int i = 0; i < after.numThrowSites; i++) {
+    if (throwSites[i].line == throwLine) {
+      g_assert_cmpstr(throwSites[i].file, ==, __FILE__);
+      g_assert_true(throwSites[i].count == 4);
+      found++;
+    }
+  }
+
+  for (int i = 0; i < after.numCatchSites; i++) {
+    if (catchSites[i].line == catchLine) {
+      g_assert_true(catchSites[i].count == 3);
+      g_assert_true(catchSites[i].ns > 0);
+      found++;
+    }
+  }
+
+  g_assert_true(found == 2);
+}
+#endif
+
+#if SX_BACKTRACE
+// Return addresses must point inside these (needs -fno-omit-frame-pointer
+// with optimization).
+__attribute__ ((noinline)) static void throwDeep(void) {
+  throw(msgex("deep"));
+}
+
+__attribute__ ((noinline)) static void callThrowDeep(void) {
+  throwDeep();
+  sxAddTraceEntry(newex());   // not a tail call.
+}
+
+static char within(void *addr, void (*func)(void)) {
+  return (uintptr_t) addr - (uintptr_t) func < 256;
+}
+
+void test_backtrace(void) {
+  int size;
+
+  try {
+    callThrowDeep();
+  } catchall {
+    void *const *frames = sxCurrentBacktrace(&size);
+    g_assert_true(size >= 0 && size <= SX_BACKTRACE);
+#ifdef __OPTIMIZE__
+    // Without -fno-omit-frame-pointer the walk stops at the first frame
+    // using it as a general register.
+    if (size >= 2)
+#endif
+    {
+      g_assert_true(size >= 2);
+      g_assert_true(within(frames[0], throwDeep));
+      g_assert_true(within(frames[1], callThrowDeep));
+    }
+  } endtry
+
+  try {
+    leave(1);
+  } catch(1) {
+    g_assert_true(sxCurrentBacktrace(&size) == NULL && size == 0);
+  } endtry
+}
+#endif
+
+#ifdef SX_RECORDER
+void test_recorder(void) {
+  try {
+  } endtry
+
+  const struct SxRecorder *rec = sxThreadRecorder();
+  const unsigned long long from = rec->next;
+
+  try {
+    errno = 3;
+    throw(msgex("recorded"));
+  } catchall {
+  } endtry
+
+  const char kinds[] = {SX_EVENT_ENTER, SX_EVENT_THROW, SX_EVENT_UNWIND,
+    SX_EVENT_ENTER, SX_EVENT_CATCH, SX_EVENT_LEAVE};
+  g_assert_true(rec->next - from == sizeof(kinds));
+
+  for (unsigned i = 0; i < sizeof(kinds); i++) {
+    g_assert_true(rec->events[(from + i) % rec->capacity].kind == kinds[i]);
+  }
+
+  char buf[128];
+  sxFormatEvent(&rec->events[(from + 1) % rec->capacity], buf, sizeof(buf));
+  g_assert_true(strstr(buf, "_throw:    code=3 file=") != NULL);
+  g_assert_true(strstr(buf, "msg=recorded") != NULL);
+}
+#endif
+
+#if SX_THREAD_EXIT
+// Leaves a malloc()'ed payload and region chunks in its state for the
+// thread-exit destructor to free (see with -fsanitize=address).
+static int threadMain(void *arg) {
+  struct SxState *own = sxSwitchState(NULL);
+  *(struct SxState **) arg = own;
+
+  try {
+    sxalloc(16);
+    struct SxTraceEntry e = msgex("in thread");
+    sxAttach(&e, SX_POOL_BLOCK + 1);
+    throw(e);
+  } catchall {
+    volatile int finallies = 0;
+
+    try {
+      nest(SX_FIRST_SEGMENT + SX_TRY_SEGMENT, &finallies);
+    } catchall {
+    } endtry
+  } endtry
+
+  return 0;
+}
+
+void test_thread(void) {
+  struct SxState *own = sxSwitchState(NULL);
+  struct SxState *other = NULL;
+  thrd_t thread;
+  int res;
+
+  g_assert_true(thrd_create(&thread, threadMain, &other) == thrd_success);
+  g_assert_true(thrd_join(thread, &res) == thrd_success);
+  g_assert_true(other != NULL && other != own);
+  g_assert_true(sxSwitchState(NULL) == own);
+}
+#endif
+
+#if defined(SX_RECORDER) && SX_THREAD_EXIT
+// Returns 1 if its sxRecorderPath file (arg) exists after the first event.
+static int recordingMain(void *arg) {
+  try {
+  } endtry
+
+  return access(arg, F_OK) == 0;
+}
+
+// A thread's file is made anew, skipping a taken name, and unlinked when the
+// thread exits.
+void test_recorder_file(void) {
+  char dir[] = "/tmp/saneex-test.XXXXXX";
+  g_assert_true(mkdtemp(dir) != NULL);
+  char base[64], target[64], taken[96], made[96];
+  snprintf(base, sizeof(base), "%s/rec", dir);
+  snprintf(target, sizeof(target), "%s/target", dir);
+  // No other test sets sxRecorderPath so the names start from 0.
+  snprintf(taken, sizeof(taken), "%s.%d.0", base, (int) getpid());
+  snprintf(made, sizeof(made), "%s.%d.1", base, (int) getpid());
+  g_assert_true(symlink(target, taken) == 0);
+
+  sxRecorderPath = base;
+  thrd_t thread;
+  int res;
+  g_assert_true(thrd_create(&thread, recordingMain, made) == thrd_success);
+  g_assert_true(thrd_join(thread, &res) == thrd_success);
+  sxRecorderPath = NULL;
+
+  g_assert_true(res == 1);
+  g_assert_true(access(made, F_OK) != 0);
+  g_assert_true(access(target, F_OK) != 0);
+  g_assert_true(unlink(taken) == 0);
+  g_assert_true(rmdir(dir) == 0);
+}
+#endif
+
+// Returns what sxExportTrace() has written.
+static char *exportTrace(char *buf, int size) {
+  int fds[2];
+  g_assert_true(pipe(fds) == 0);
+  g_assert_true(sxExportTrace(fds[1]) == 0);
+  close(fds[1]);
+  const int n = read(fds[0], buf, size - 1);
+  close(fds[0]);
+  g_assert_true(n > 0 && buf[n - 1] == '\n');
+  buf[n] = '\0';
+  return buf;
+}
+
+void test_export(void) {
+  char buf[8192];
+  char *tag = sxTag;
+  sxTag = "v1";
+
+  try {
+    try {
+      errno = 3;
+      throw(sxprintf(newex(), "%d%% of \"%s\"", 42, "a\tb"));
+    } endtry
+  } catchall {
+    g_assert_true(strstr(exportTrace(buf, sizeof(buf)),
+      "{\"tag\":\"v1\",\"trace\":[{\"code\":3,\"uncatchable\":false,"
+      "\"file\":\"" __FILE__ "\",\"line\":") == buf);
+    g_assert_true(strstr(buf, ",\"message\":\"42% of \\\"a\\u0009b\\\"\","
+      "\"passed\":1}]") != NULL);
+  } endtry
+
+  try {
+    throw(sxprintf(newex(), "%ld and %.1f", -12L, 2.5));
+  } catchall {
+    exportTrace(buf, sizeof(buf));
+    // Only with SX_DEFER_ARGS.
+    g_assert_true(strstr(buf,
+      ",\"format\":\"%ld and %.1f\",\"args\":[-12,2.500000]}") != NULL ||
+      strstr(buf, ",\"message\":\"-12 and 2.5\"}") != NULL);
+  } endtry
+
+  // A double too large to scale to micro units is in exponent form.
+  try {
+    throw(sxprintf(newex(), "%.0f %f", 1e15, -2.5e300));
+  } catchall {
+    exportTrace(buf, sizeof(buf));
+    g_assert_true(strstr(buf,
+      "\"args\":[1.000000e15,-2.500000e300]}") != NULL ||
+      strstr(buf, "\"message\":\"1000000000000000 -2") != NULL);
+  } endtry
+
+  // Unsigned conversions are exported as printf() shows them.
+  try {
+    throw(sxprintf(newex(), "%x %llu %d", 0xffffffffu, ~0ULL, -1));
+  } catchall {
+    exportTrace(buf, sizeof(buf));
+    g_assert_true(strstr(buf,
+      "\"args\":[4294967295,18446744073709551615,-1]}") != NULL ||
+      strstr(buf,
+      "\"message\":\"ffffffff 18446744073709551615 -1\"}") != NULL);
+    g_assert_cmpstr(curex().message, ==, "ffffffff 18446744073709551615 -1");
+  } endtry
+
+  // Only what fits in 4 KiB.
+  try {
+    try {
+      throw(msgex("x"));
+    } catchall {
+      static char message[1000];   // kept by pointer.
+      memset(message, '\n', sizeof(message) - 1);
+      message[sizeof(message) - 1] = '\0';
+      rethrow(msgex(message));
+    } endtry
+  } catchall {
+    exportTrace(buf, sizeof(buf));
+    g_assert_true(strstr(buf, "\"message\":\"x\"}],\"truncated\":true}\n")
+      != NULL);
+  } endtry
+
+  sxTag = tag;
+}
+
+#ifdef SX_FAULTS
+static int *volatile nullPtr;
+static volatile sig_atomic_t raised;
+
+static void onRaised(int sig) {
+  raised = sig;
+}
+
+void test_faults(void) {
+  // Must be left alone by sxCatchFaults()' handler.
+  signal(SIGFPE, onRaised);
+  g_assert_true(sxCatchFaults() == 0);
+  g_assert_true(sxCatchFaults() == 0);
+
+  const int depth = sxDeferDepth();
+  volatile int log = 0;
+
+  try {
+    try {
+      try {
+        *nullPtr = 1;
+        g_test_fail();
+      } finally {
+        log |= 1;
+      } endtry
+    } finally {
+      log |= 2;
+    } endtry
+  } catch(SX_FAULT) {
+    const struct SxFault *f = curextra(struct SxFault);
+    g_assert_true(f != NULL);
+    g_assert_true(f->signal == SIGSEGV && f->code == SEGV_MAPERR);
+    g_assert_true(f->address == NULL);
+    g_assert_cmpstr(curex().message, ==, "Segmentation fault");
+    log |= 4;
+  } endtry
+
+  g_assert_true(log == (1 | 2 | 4));
+
+  // Neither catchall nor finally is entered again when they fault.
+  try {
+    try {
+      *nullPtr = 1;
+    } catchall {
+      log |= 8;
+      *nullPtr = 2;
+    } finally {
+      log |= 16;
+      *nullPtr = 3;
+    } endtry
+    g_test_fail();
+  } catch(SX_FAULT) {
+    g_assert_true(curextra(struct SxFault)->signal == SIGSEGV);
+    log |= 32;
+  } endtry
+
+  g_assert_true(log == (1 | 2 | 4 | 8 | 16 | 32));
+
+  // Reading past the end of a mapped file.
+  FILE *file = tmpfile();
+  g_assert_true(file != NULL);
+  char *volatile map = mmap(NULL, 4096, PROT_READ, MAP_PRIVATE, fileno(file),
+    0);
+  g_assert_true(map != MAP_FAILED);
+
+  try {
+    log = map[1];
+    g_test_fail();
+  } catch(SX_FAULT) {
+    const struct SxFault *f = curextra(struct SxFault);
+    g_assert_true(f->signal == SIGBUS && f->address == map + 1);
+  } endtry
+
+  munmap(map, 4096);
+  fclose(file);
+
+  // Not every CPU (e.g. ARM) or emulator traps on integer division by zero.
+  volatile int zero = 0;
+
+  try {
+    log = 1 / zero;
+  } catch(SX_FAULT) {
+    const struct SxFault *f = curextra(struct SxFault);
+    g_assert_true(f->signal == SIGFPE && f->code == FPE_INTDIV);
+  } endtry
+
+  try {
+    raise(SIGFPE);
+  } catchall {
+    g_test_fail();
+  } endtry
+
+  g_assert_true(raised == SIGFPE);
+  g_assert_true(sxDeferDepth() == depth);
+
+  try {
+    errno = 3;
+    throw(newex());
+  } catch(3) {
+    log = 1;
+  } endtry
+
+  g_assert_true(log == 1);
+}
+#endif
+
+static const int three = 3, seven = 7;
+static int filterCalls;
+
+static char codeIs(int code, const struct SxTraceEntry *entry, void *data) {
+  filterCalls++;
+  g_assert_true(entry != NULL && entry->code == code);
+  return code == *(const int *) data;
+}
+
+// Accepts the exception if its message is data.
+static char messageIs(int code, const struct SxTraceEntry *entry, void *data) {
+  (void) code;
+  return strcmp(entry->message, data) == 0;
+}
+
+static void countEntry(const struct SxTraceEntry *entry, void *data) {
+  (void) entry;
+  (void) data;
+}
+
+static int jumps;
+
+// Used as catch(jumped()): the condition is evaluated only when the try was
+// jumped to, and never matches.
+static int jumped(void) {
+  jumps++;
+  return -1;
+}
+
+void test_filter(void) {
+  volatile int log = 0;
+
+  // Declined without a finally: jumped to only the first time (when the try
+  // isn't yet known to have no finally), then passed without a jump.
+  for (volatile int round = 0; round < 2; round++) {
+    try {
+      tryif(codeIs, (void *) &seven) {
+        errno = 3;
+        throw(newex());
+      } catch(jumped()) {
+        g_test_fail();
+      } catchall {
+        g_test_fail();
+      } endtry
+      g_test_fail();
+    } catch(3) {
+      g_assert_true(sxWalkTrace(countEntry, NULL) == 1);
+      g_assert_true(curexp()->passed == 1);
+      log |= 1;
+    } endtry
+  }
+
+  g_assert_true(jumps == 1);
+  g_assert_true(filterCalls == 2);
+
+  tryif(codeIs, (void *) &seven) {
+    errno = 7;
+    throw(newex());
+  } catch(7) {
+    log |= 2;
+  } endtry
+
+  // Declined with a finally: only the finally runs.
+  try {
+    tryif(codeIs, (void *) &seven) {
+      errno = 3;
+      throw(newex());
+    } catchall {
+      g_test_fail();
+    } finally {
+      log |= 4;
+    } endtry
+  } catch(3) {
+    log |= 8;
+  } endtry
+
+  try {
+    tryif(codeIs, (void *) &three) {
+      tryif(codeIs, (void *) &seven) {
+        errno = 3;
+        throw(newex());
+      } catch(3) {
+        g_test_fail();
+      } endtry
+    } catch(3) {
+      log |= 16;
+      // Records of the tries left are gone.
+      const int calls = filterCalls;
+
+      try {
+        errno = 5;
+        throw(newex());
+      } catch(5) {
+        g_assert_true(filterCalls == calls);
+      } endtry
+    } endtry
+  } catchall {
+    g_test_fail();
+  } endtry
+
+  // Not asked about leave().
+  const int calls = filterCalls;
+
+  tryif(codeIs, (void *) &seven) {
+    leave(3);
+  } catch(3) {
+    log |= 32;
+  } endtry
+
+  g_assert_true(filterCalls == calls);
+
+  // A deferred sxprintf() message is formatted for the filter.
+  tryif(messageIs, "timeout 30") {
+    throw(sxprintf(newex(), "timeout %d", 30));
+  } catchall {
+    log |= 64;
+  } endtry
+
+  g_assert_true(log == (1 | 2 | 4 | 8 | 16 | 32 | 64));
+}
+
+static int lostFd;
+
+// The tries are passed once (by code 3) so that it's known which can catch.
+static void lose(int code) {
+  try {
+    tryif(codeIs, (void *) &seven) {
+      if (code) {
+        errno = code;
+        throw(msgex("lost"));
+      }
+    } catchall {
+    } endtry
+  } finally {
+    if (code == 9) { g_assert_true(write(lostFd, "finally\n", 8) == 8); }
+  } endtry
+}
+
+// A unit built with different SX_MAX_... makes the program exit.
+void test_layout(void) {
+  fflush(stdout);
+  const pid_t pid = fork();
+  g_assert_true(pid >= 0);
+
+  if (!pid) {
+    dup2(open("/dev/null", O_WRONLY), 2);
+    _sxCheckLayout(sizeof(struct SxState), __FILE__);
+    _sxCheckLayout(sizeof(struct SxState) + 1, __FILE__);
+    _exit(1);
+  }
+
+  int status;
+  g_assert_true(waitpid(pid, &status, 0) == pid);
+  g_assert_true(WIFEXITED(status) &&
+                WEXITSTATUS(status) == EXIT_LAYOUT_MISMATCH);
+}
+
+void test_uncaught(void) {
+  int fds[2];
+  g_assert_true(pipe(fds) == 0);
+  fflush(stdout);
+  const pid_t pid = fork();
+  g_assert_true(pid >= 0);
+
+  if (!pid) {
+    close(fds[0]);
+    dup2(fds[1], 2);
+    sxExportFd = lostFd = fds[1];
+    try {
+      lose(3);
+    } catchall {
+    } endtry
+
+    lose(9);
+    _exit(1);
+  }
+
+  close(fds[1]);
+  char buf[4096];
+  int n = 0;
+
+  for (int got; (got = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0; ) {
+    n += got;
+  }
+
+  close(fds[0]);
+  buf[n] = '\0';
+  int status;
+  g_assert_true(waitpid(pid, &status, 0) == pid);
+  g_assert_true(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_UNCAUGHT + 9);
+
+  // Exported before the finally has run, without claiming to terminate until
+  // after it.
+  const char *trace = strstr(buf, "\"message\":\"lost\"");
+  const char *fin = strstr(buf, "finally\n");
+  g_assert_true(trace && fin && trace < fin);
+  g_assert_true(strstr(fin, "\"message\"") == NULL);
+  const char *early = strstr(buf, "won't be caught");
+  g_assert_true(early && early < fin);
+  g_assert_true(strstr(buf, "terminating") > fin);
+}
+
+#define HOUR (3600 * 1000000000LL)
+
+static void catchFive(int code) {
+  try {
+    if (code) {
+      errno = code;
+      throw(newex());
+    }
+  } catch(5) {
+  } endtry
+}
+
+void test_deadline(void) {
+  volatile int log = 0;
+
+  // No effect outside of deadline scopes.
+  sxCheckDeadline();
+
+  deadline(HOUR) {
+    sxCheckDeadline();
+    log++;
+  } enddeadline
+
+  deadline(0) {
+    log++;
+  } enddeadline
+
+  // Popped even if not checked (else the above one would throw here).
+  try {
+    sxCheckDeadline();
+  } catchall {
+    g_test_fail();
+  } endtry
+
+  g_assert_true(log == 2);
+
+  // Only the scope whose own time has passed stops the timeout.
+  deadline(0) {
+    deadline(HOUR) {
+      try {
+        sxCheckDeadline();
+        g_test_fail();
+      } catchall {
+        g_assert_true(curex().code == SX_TIMEOUT);
+        g_assert_cmpstr(curex().message, ==, "Deadline exceeded");
+        log |= 4;
+      } endtry
+      g_test_fail();
+    } catch(SX_TIMEOUT) {
+      log |= 8;
+    } finally {
+      log |= 16;
+    } enddeadline
+    g_test_fail();
+  } catch(SX_TIMEOUT) {
+    log |= 32;
+  } enddeadline
+
+  g_assert_true(log == (2 | 4 | 8 | 16 | 32));
+
+  // The tightest deadline wins.
+  log = 0;
+
+  deadline(HOUR) {
+    deadline(0) {
+      sxCheckDeadline();
+      g_test_fail();
+    } enddeadline
+    sxCheckDeadline();
+    log++;
+  } enddeadline
+
+  g_assert_true(log == 1);
+
+  deadline(0) {
+    deadline(HOUR) {
+      log++;
+    } enddeadline
+    sxCheckDeadline();
+    g_test_fail();
+  } enddeadline
+
+  g_assert_true(log == 2);
+
+  // A scope entered while handling the timeout doesn't take it.
+  deadline(0) {
+    sxCheckDeadline();
+  } catchall {
+    deadline(HOUR) {
+      log++;
+    } enddeadline
+  } enddeadline
+
+  g_assert_true(log == 3);
+
+  // Other exceptions pass deadline scopes as usual.
+  try {
+    deadline(HOUR) {
+      errno = 5;
+      throw(newex());
+    } enddeadline
+    g_test_fail();
+  } catch(5) {
+    log++;
+  } endtry
+
+  g_assert_true(log == 4);
+
+  // A try that completes inside a finally while the timeout is unwinding
+  // isn't taken for one without a catch.
+  deadline(0) {
+    sxCheckDeadline();
+  } finally {
+    catchFive(0);
+  } enddeadline
+
+  catchFive(5);
+
+  try {
+    sxCheckDeadline();
+  } catchall {
+    g_test_fail();
+  } endtry
+
+  // The timeout of deadlinex(ns, 1) is caught inside; the next check throws
+  // it again.
+  log = 0;
+
+  deadlinex(0, 1) {
+    try {
+      sxCheckDeadline();
+      g_test_fail();
+    } catch(SX_TIMEOUT) {
+      g_assert_true(!curex().uncatchable);
+      log++;
+    } endtry
+
+    log++;
+    sxCheckDeadline();
+    g_test_fail();
+  } catch(SX_TIMEOUT) {
+    log++;
+  } enddeadline
+
+  g_assert_true(log == 3);
+}
+
+int main(int argc, char **argv) {
+  g_test_init(&argc, &argv, NULL);
+
+  // (f)inally, (F) with exception
+
+  g_test_add_func("/TE/case000",      test_case000);
+  g_test_add_func("/TE/case000f",     test_case000f);
+  g_test_add_func("/TE/case000F",     test_case000F);
+
+  g_test_add_func("/TCE/case010",     test_case010);
+  g_test_add_func("/TCE/case010f",    test_case010f);
+  g_test_add_func("/TCE/case010F",    test_case010F);
+
+  g_test_add_func("/T!E/case100",     test_case100);
+  g_test_add_func("/T!E/case100f",    test_case100f);
+  g_test_add_func("/T!E/case100F",    test_case100F);
+
+  g_test_add_func("/T!CE/case110",    test_case110);
+  g_test_add_func("/T!CE/case110f",   test_case110f);
+  g_test_add_func("/T!CE/case110F",   test_case110F);
+
+  g_test_add_func("/T!C!E/case111",   test_case111);
+  g_test_add_func("/T!C!E/case111f",  test_case111f);
+  g_test_add_func("/T!C!E/case111F",  test_case111F);
+
+  g_test_add_func("/deep",            test_deep);
+  g_test_add_func("/message",         test_message);
+  g_test_add_func("/pointers",        test_pointers);
+  g_test_add_func("/passed",          test_passed);
+  g_test_add_func("/deferred",        test_deferred);
+  g_test_add_func("/attach",          test_attach);
+  g_test_add_func("/leave",           test_leave);
+  g_test_add_func("/catchswitch",     test_catchswitch);
+  g_test_add_func("/result",          test_result);
+  g_test_add_func("/defer",           test_defer);
+  g_test_add_func("/region",          test_region);
+  g_test_add_func("/state",           test_state);
+  g_test_add_func("/export",          test_export);
+  g_test_add_func("/deadline",        test_deadline);
+  g_test_add_func("/filter",          test_filter);
+  g_test_add_func("/uncaught",        test_uncaught);
+  g_test_add_func("/layout",          test_layout);
+#ifdef SX_TELEMETRY
+  g_test_add_func("/telemetry",       test_telemetry);
+#endif
+#if SX_BACKTRACE
+  g_test_add_func("/backtrace",       test_backtrace);
+#endif
+#ifdef SX_FAULTS
+  g_test_add_func("/faults",          test_faults);
+#endif
+#ifdef SX_RECORDER
+  g_test_add_func("/recorder",        test_recorder);
+#endif
+#if SX_THREAD_EXIT
+  g_test_add_func("/thread",          test_thread);
+#endif
+#if defined(SX_RECORDER) && SX_THREAD_EXIT
+  g_test_add_func("/recorder_file",   test_recorder_file);
+#endif
 
   return g_test_run();
 }
@@ -1,79 +1,175 @@
 /* saneex.c - Pure C99 Exceptions (try/catch/finally)
    by Proger_XP | https://github.com/ProgerXP/SaneC | public domain (CC0) */
 
+// clock_gettime() for deadlines and SX_TELEMETRY, mmap() and others for
+// SX_RECORDER, dladdr() for SX_BACKTRACE.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <float.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+// Have saneex.h define the try..catch functions as regular ones.
+#define _SX_DEFINE_FAST
 #include "saneex.h"
 
-#ifdef SX_ASSERT
-#ifndef NDEBUG
-#include <assert.h>
-#define sxAssert(x, c) \
-  assert(x)
+#if SX_THREAD_EXIT
+#include <threads.h>
 #endif
+
+#include <time.h>
+
+#if SX_BACKTRACE && (defined(__unix__) || defined(__APPLE__))
+#include <dlfcn.h>
+#define HAVE_DLADDR
 #endif
 
-#ifndef sxAssert
-#define sxAssert(x, c) \
-  if (!(x)) \
-    fprintf(stderr, "saneex.c assertion error: %s (%s:%d)\n", \
-      #x, __FILE__, __LINE__), \
-    exit(c)
+#ifdef SX_RECORDER
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
-struct TryContext {
-  // jmp_buf's type is an array.
-  jmp_buf buf;
-  int caught;
-};
+#ifdef SX_FAULTS
+#ifdef _WIN32
+#error SX_FAULTS needs POSIX signals.
+#endif
+#include <signal.h>
+#endif
 
-#define MAX_TRY_CATCH 100
-static SX_THREAD_LOCAL int nextContext;
-static SX_THREAD_LOCAL struct TryContext contexts[MAX_TRY_CATCH];
-// _sxLastJumpCode is only meaningful for contexts[nextContext - 1].
-SX_THREAD_LOCAL int _sxLastJumpCode = -1;
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
 
-#define MAX_TRACE 20
-static SX_THREAD_LOCAL int nextTrace;
-static SX_THREAD_LOCAL struct SxTraceEntry trace[MAX_TRACE];
-static SX_THREAD_LOCAL char hasUncatchable;
+SX_THREAD_LOCAL struct SxState *_sxThreadState SX_TLS_MODEL;
+SX_THREAD_LOCAL struct SxState *_sxState SX_TLS_MODEL;
 // Standard date/time directives are in the local TZ.
 char *sxTag = __DATE__ " " __TIME__;
+const char *sxRecorderPath;
+int sxExportFd = -1;
+
+// For data that other threads read (telemetry, recorder). Only the owning
+// thread writes such data so BUMP() needs no atomic read-modify-write.
+#ifdef __GNUC__
+#define LOAD(var)         __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define STORE(var, value) __atomic_store_n(&(var), value, __ATOMIC_RELEASE)
+#define BUMP(var, by) \
+  __atomic_store_n(&(var), (var) + (by), __ATOMIC_RELAXED)
+#define CAS(var, old, value) \
+  __atomic_compare_exchange_n(&(var), &(old), value, 0, __ATOMIC_ACQ_REL, \
+    __ATOMIC_ACQUIRE)
+#else
+#define LOAD(var)         (var)
+#define STORE(var, value) ((var) = (value))
+#define BUMP(var, by)     ((var) += (by))
+#define CAS(var, old, value) ((var) == (old) ? ((var) = (value), 1) : 0)
+#endif
+
+void _sxAssertFailed(const char *expr, const char *file, int line, int code) {
+  fprintf(stderr, "saneex assertion error: %s (%s:%d)\n", expr, file, line);
+  exit(code);
+}
+
+void _sxCheckLayout(size_t stateSize, const char *file) {
+  if (stateSize != sizeof(struct SxState)) {
+    fprintf(stderr, "saneex: %s sees struct SxState of %zu bytes, saneex.c"
+      " of %zu (SX_MAX_... must match)\n", file, stateSize,
+      sizeof(struct SxState));
+    exit(EXIT_LAYOUT_MISMATCH);
+  }
+}
 
 int sxWalkTrace(void func(const struct SxTraceEntry *, void *), void *data) {
-  for (int i = 0; i < nextTrace; i++) {
-    func(&trace[i], data);
+  struct SxState *st = _sxGetState();
+
+  for (int i = 0; i < st->nextTrace; i++) {
+    sxMessage(&st->trace[i]);
+    func(&st->trace[i], data);
   }
 
-  return nextTrace;
+  return st->nextTrace;
 }
 
 void sxPrintEntryToStdErr(const struct SxTraceEntry *entry, void *data) {
   char ptr[20];
   int n = entry->extra == NULL ? 0 : snprintf(ptr, 20, " (%p)", entry->extra);
   ptr[n] = '\0';
+  char passed[32];
+  n = !entry->passed ? 0
+    : snprintf(passed, 32, ", then through %d try", entry->passed);
+  passed[n] = '\0';
+  const char *message = sxMessage(entry);
 
   fprintf(stderr,
       "%s%s"
       "    ...%sat %s:%d, code %d"
-      "%s"
+      "%s%s"
       "\n",
-    *entry->message == '\0' ? "" : entry->message,
-    *entry->message == '\0' ? "" : "\n",
+    message,
+    *message == '\0' ? "" : "\n",
     entry->uncatchable ? "UNCATCHABLE " : "",
-    entry->file, entry->line, entry->code,
-    ptr
+    entry->file ? entry->file : "?", entry->line, entry->code,
+    ptr, passed
   );
 }
 
+// Prints addr as "function+offset (module+offset)", as much as is known.
+// The module offset is what addr2line -e module expects (return addresses
+// point past the call so the line may be the next one).
+static void printFrame(int index, void *addr) {
+  fprintf(stderr, "    #%-2d %p", index, addr);
+
+#ifdef HAVE_DLADDR
+  Dl_info info;
+
+  if (dladdr(addr, &info) && info.dli_fname) {
+    if (info.dli_sname) {
+      fprintf(stderr, " %s+0x%lx", info.dli_sname,
+        (unsigned long) ((char *) addr - (char *) info.dli_saddr));
+    }
+
+    fprintf(stderr, " (%s+0x%lx)", info.dli_fname,
+      (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+  }
+#endif
+
+  fprintf(stderr, "\n");
+}
+
 void sxPrintTrace() {
   sxWalkTrace(sxPrintEntryToStdErr, NULL);
+  int size;
+  void *const *frames = sxCurrentBacktrace(&size);
+
+  if (size) {
+    fprintf(stderr, "Backtrace (the innermost first):\n");
+    for (int i = 0; i < size; i++) { printFrame(i, frames[i]); }
+  }
+}
+
+void *const *sxCurrentBacktrace(int *size) {
+#if SX_BACKTRACE
+  struct SxState *st = _sxGetState();
+  *size = st->backtraceSize;
+  return *size ? st->backtrace : NULL;
+#else
+  *size = 0;
+  return NULL;
+#endif
 }
 
 struct SxTraceEntry sxCurrentException(void) {
+  struct SxState *st = _sxGetState();
   struct SxTraceEntry copy;
 
-  if (nextTrace > 0) {
-    copy = trace[0];
+  if (st->nextTrace > 0) {
+    sxMessage(&st->trace[0]);
+    copy = st->trace[0];
   } else {
     copy.code = -1;
   }
@@ -81,6 +177,17 @@ struct SxTraceEntry sxCurrentException(void) {
   return copy;
 }
 
+const struct SxTraceEntry *sxCurrentExceptionPtr(void) {
+  struct SxState *st = _sxGetState();
+
+  if (st->nextTrace > 0) {
+    sxMessage(&st->trace[0]);
+    return &st->trace[0];
+  }
+
+  return NULL;
+}
+
 char *sxlcpy(char *dest, const char *src) {
   return sxlcpyn(dest, src, SX_MAX_TRACE_STRING);
 }
@@ -99,186 +206,1813 @@ char *sxlcpyn(char *dest, const char *src, int n) {
   return dest;
 }
 
-struct SxTraceEntry sxprintf(struct SxTraceEntry entry, const char *fmt, ...) {
-  va_list arg;
+// Determines if s points into texts (was formatted by sxprintf()) rather than
+// to a static string.
+static char isText(struct SxState *st, const char *s) {
+  return (uintptr_t) s - (uintptr_t) st->texts < sizeof(st->texts);
+}
 
-  va_start(arg, fmt);
-  vsnprintf(entry.message, SX_MAX_TRACE_STRING, fmt, arg);
-  va_end(arg);
+// Determines if p points to an inline payload of an entry in the trace rather
+// than of a scratch row, a row freed by clearTrace() (or elsewhere).
+static char isTracePayload(struct SxState *st, const void *p) {
+  return (uintptr_t) p - (uintptr_t) st->payloads <
+    st->nextTrace * sizeof(st->payloads[0]);
+}
 
-  return entry;
+// Types of sxprintf() arguments that can be deferred. ARG_NONE marks "%%",
+// ARG_EAGER - anything that must be formatted right away. ARG_UNSIGNED is
+// or'ed to an integer type for %u, %o, %x and %X.
+enum {ARG_NONE, ARG_EAGER, ARG_INT, ARG_LONG, ARG_LLONG, ARG_INTMAX, ARG_SIZE,
+  ARG_PTRDIFF, ARG_DOUBLE, ARG_PTR, ARG_UNSIGNED = 16};
+
+union Arg {
+  intmax_t i;
+  uintmax_t u;        // of ARG_UNSIGNED.
+  double d;
+  const void *p;
+};
+
+// Stored in a texts row after the leading '\0' (unaligned, so via memcpy()).
+struct Deferred {
+  const char *fmt;
+  int count;
+  union Arg args[SX_DEFER_ARGS ? SX_DEFER_ARGS : 1];
+};
+
+#define CAN_DEFER (SX_DEFER_ARGS > 0 && \
+  1 + sizeof(struct Deferred) <= SX_MAX_TRACE_STRING)
+
+// Advances *fmt past the next conversion (or literal text if *fmt doesn't
+// start with '%'). Returns one of ARG_... and the conversion in spec (0 if
+// literal); spec must have room for 16 chars.
+static int nextSpec(const char **fmt, char *spec) {
+  const char *s = *fmt;
+
+  if (*s != '%') {
+    *fmt = s + strcspn(s, "%");
+    spec[0] = '\0';
+    return ARG_NONE;
+  }
+
+  const char *start = s++;
+  while (*s && strchr("-+ #0", *s)) { s++; }
+  while (*s >= '0' && *s <= '9') { s++; }
+
+  if (*s == '.') {
+    s++;
+    while (*s >= '0' && *s <= '9') { s++; }
+  }
+
+  int type = ARG_INT;
+
+  switch (*s) {
+  case 'h': s += 1 + (s[1] == 'h'); break;
+  case 'l': type = s[1] == 'l' ? ARG_LLONG : ARG_LONG; s += 1 + (s[1] == 'l'); break;
+  case 'j': type = ARG_INTMAX; s++; break;
+  case 'z': type = ARG_SIZE; s++; break;
+  case 't': type = ARG_PTRDIFF; s++; break;
+  }
+
+  switch (*s) {
+  case 'd': case 'i':
+    break;
+  case 'c':   // %lc takes a wint_t.
+    if (type != ARG_INT) { type = ARG_EAGER; }
+    break;
+  case 'u': case 'o': case 'x': case 'X':
+    type |= ARG_UNSIGNED;
+    break;
+  case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+    type = type == ARG_INT ? ARG_DOUBLE : ARG_EAGER;
+    break;
+  case 'p':
+    type = type == ARG_INT ? ARG_PTR : ARG_EAGER;
+    break;
+  case '%':
+    type = s - start == 1 ? ARG_NONE : ARG_EAGER;
+    break;
+  default:    // %s, %n, '*', 'L' and the unknown.
+    type = ARG_EAGER;
+  }
+
+  if (*s) { s++; }
+  *fmt = s;
+
+  if (s - start >= 16) {
+    type = ARG_EAGER;
+  } else {
+    memcpy(spec, start, s - start);
+    spec[s - start] = '\0';
+  }
+
+  return type;
 }
 
-void sxAddTraceEntry(const struct SxTraceEntry entry) {
-  // trace[0] is the first stack frame - it has initiated the exception.
-  if (nextTrace < MAX_TRACE &&
-      (entry.file || entry.message || entry.extra)) {
-    // An uncanny feature of fixed-length char[N]'s is that the compiler won't
-    // complain if it's assigned a string exactly N chars long, and it won't
-    // insert '\0' (because it doesn't fit) so the string will overflow:
-    //
-    //   (struct SxTraceEntry) { .file = "..."; } // ... = SX_MAX_TRACE_STRING long
-    //   in the end, .file looks exactly like "...", not "...\0"
-    trace[nextTrace] = entry;
-    trace[nextTrace].file[SX_MAX_TRACE_STRING-1] = '\0';
-    trace[nextTrace].message[SX_MAX_TRACE_STRING-1] = '\0';
-    nextTrace++;
-  }
-}
-
-SX_NORETURN static void _throw(const struct SxTraceEntry entry) {
-  sxAddTraceEntry(entry);
-  hasUncatchable |= entry.uncatchable;
-  const int code = entry.code;
+// Fills d from arg if fmt can be deferred. Works on a copy of arg so that it
+// can still be given to vsnprintf() if not.
+static char captureArgs(struct Deferred *d, const char *fmt, va_list arg) {
+  char spec[16];
+  char ok = 1;
+  va_list copy;
+  va_copy(copy, arg);
+  d->fmt = fmt;
+  d->count = 0;
 
-#ifdef SX_VERBOSE
-  fprintf(stderr, "% 3d _throw:    code=%d file=%s:%d msg=%s\n",
-    nextContext, entry.code, entry.file, entry.line, entry.message);
-#endif
+  for (const char *s = fmt; *s && ok; ) {
+    int type = nextSpec(&s, spec);
+    if (type == ARG_NONE) { continue; }
 
-  if (nextContext < 1) {
-    // No wrapping try..catch block so this is an "uncaught exception".
-    fprintf(stderr, "Uncaught exception (code %d) - terminating. Tag: %s\n",
-      code, sxTag);
-    sxPrintTrace();
-    int exitCode = EXIT_UNCAUGHT + code;
-    exit(exitCode > 254 ? 254 : exitCode);
+    if (d->count >= SX_DEFER_ARGS) {
+      ok = 0;
+      break;
+    }
+
+    union Arg *a = &d->args[d->count++];
+
+    // Zero-extended so that the export shows them as printf() does.
+    if (type & ARG_UNSIGNED) {
+      switch (type & ~ARG_UNSIGNED) {
+      case ARG_INT:     a->u = va_arg(copy, unsigned); break;
+      case ARG_LONG:    a->u = va_arg(copy, unsigned long); break;
+      case ARG_LLONG:   a->u = va_arg(copy, unsigned long long); break;
+      case ARG_INTMAX:  a->u = va_arg(copy, uintmax_t); break;
+      case ARG_SIZE:    a->u = va_arg(copy, size_t); break;
+      case ARG_PTRDIFF: a->u = (size_t) va_arg(copy, ptrdiff_t); break;
+      }
+
+      continue;
+    }
+
+    switch (type) {
+    case ARG_INT:     a->i = va_arg(copy, int); break;
+    case ARG_LONG:    a->i = va_arg(copy, long); break;
+    case ARG_LLONG:   a->i = va_arg(copy, long long); break;
+    case ARG_INTMAX:  a->i = va_arg(copy, intmax_t); break;
+    case ARG_SIZE:    a->i = (intmax_t) va_arg(copy, size_t); break;
+    case ARG_PTRDIFF: a->i = va_arg(copy, ptrdiff_t); break;
+    case ARG_DOUBLE:  a->d = va_arg(copy, double); break;
+    case ARG_PTR:     a->p = va_arg(copy, void *); break;
+    default:          ok = 0;   // ARG_EAGER.
+    }
   }
 
-  longjmp( contexts[nextContext - 1].buf, code > 0 ? code : 1 );
+  va_end(copy);
+  return ok;
 }
 
-// A "try" is split into two calls to _sxEnterTry/2() because:
-//   "If the function which called setjmp() returns before longjmp() is called,
-//    the behavior is undefined."
-// try cannot be just a call to _sxEnterTry() with setjmp() inside it so
-// as long as each try is paired with an endtry - it will work
-// (there's no way to leave a function bypassing endtry when using re/throw).
-jmp_buf *_sxEnterTry(void) {
-  sxAssert(nextContext < MAX_TRY_CATCH, EXIT_MAX_TRIES);
-  contexts[nextContext].caught = 0;
-  return &contexts[nextContext++].buf;
+// Formats texts[row] in place if it's deferred.
+static void resolve(struct SxState *st, int row) {
+  if (!st->deferred[row]) { return; }
+
+  struct Deferred d;
+  memcpy(&d, st->texts[row] + 1, sizeof(d));
+  st->deferred[row] = 0;
+
+  char *out = st->texts[row];
+  char *const end = out + SX_MAX_TRACE_STRING;
+  union Arg *a = d.args;
+  char spec[16];
+
+  for (const char *s = d.fmt; *s && out < end - 1; ) {
+    const char *start = s;
+    int type = nextSpec(&s, spec);
+    int n = 0;
+
+    // Unsigned values are given as the signed type of the same size.
+    switch (type & ~ARG_UNSIGNED) {
+    case ARG_NONE:
+      if (spec[0]) {
+        *out = '%', n = 1;
+      } else {
+        n = s - start;
+        memcpy(out, start, n < end - 1 - out ? n : end - 1 - out);
+      }
+      break;
+    case ARG_INT:     n = snprintf(out, end - out, spec, (int) a++->i); break;
+    case ARG_LONG:    n = snprintf(out, end - out, spec, (long) a++->i); break;
+    case ARG_LLONG:   n = snprintf(out, end - out, spec, (long long) a++->i); break;
+    case ARG_INTMAX:  n = snprintf(out, end - out, spec, a++->i); break;
+    case ARG_SIZE:    n = snprintf(out, end - out, spec, (size_t) a++->i); break;
+    case ARG_PTRDIFF: n = snprintf(out, end - out, spec, (ptrdiff_t) a++->i); break;
+    case ARG_DOUBLE:  n = snprintf(out, end - out, spec, a++->d); break;
+    case ARG_PTR:     n = snprintf(out, end - out, spec, a++->p); break;
+    }
+
+    // An encoding error (e.g. %lc of an invalid character) outputs nothing.
+    if (n < 0) { n = 0; }
+    out += n < end - 1 - out ? n : end - 1 - out;
+  }
+
+  *out = '\0';
 }
 
-// Returns 0 if entering a try block, non-0 if entering a catch block (i.e.
-// a throw was called).
-char _sxEnterTry2(int code) {
-#ifdef SX_VERBOSE
-  fprintf(stderr, "% 3d _sxEnterTry2: code=%d caught=%d\n", nextContext, code,
-    contexts[nextContext -1].caught);
-#endif
+const char *sxMessage(const struct SxTraceEntry *entry) {
+  struct SxState *st = _sxGetState();
+  const char *message = entry->message;
+
+  if (isText(st, message)) {
+    resolve(st, (message - st->texts[0]) / SX_MAX_TRACE_STRING);
+  }
 
-  // Used to catch bugs due to an infinite throw/try/throw/... loop.
-  sxAssert(contexts[nextContext - 1].caught < 1000, EXIT_TOO_NESTED);
-  return (_sxLastJumpCode = code) == 0;
+  return message ? message : "";
 }
 
-void _sxLeaveTry(const char *file, int line) {
-  sxAssert(--nextContext >= 0, EXIT_NO_TRY_ON_LEAVE);
+// sxExportTrace()'s output buffer. Writing stops at end; if something didn't
+// fit then full is set.
+struct Out {
+  char *p;
+  char *end;
+  char full;
+};
 
-#ifdef SX_VERBOSE
-  struct TryContext *cx = &contexts[nextContext];
+static void put(struct Out *out, const char *s, size_t n) {
+  if ((size_t) (out->end - out->p) < n) {
+    out->full = 1;
+  } else {
+    memcpy(out->p, s, n);
+    out->p += n;
+  }
+}
 
-  fprintf(stderr, "% 3d _sxLeaveTry:  code=%d caught=%d file=%s:%d\n",
-    nextContext + 1, _sxLastJumpCode, cx->caught, file, line);
-#endif
+#define PUT(out, literal) put(out, literal, sizeof(literal) - 1)
 
-  // Possible cases:
-  // * (T)RY - always present
-  // * (!)throw within TRY - yes/no
-  // * (C)ATCH - yes/no (only considering a matching N or CATCHALL)
-  // * (!)throw within CATCH - yes/no
-  // * FINALLY - no (discussed layer)
-  // * (E)NDTRY - always present
-  //
-  //   2TRY     = state at setjmp() returning != 0 first time
-  //   1CATCH   = first time to CATCH (_sxSetCaught())
-  //   LJC      = _sxLastJumpCode
-  //   C        = caught
-  //   unreach. = never called
-  //
-  //                2TRY        1CATCH    3TRY    2CATCH  ENDTRY
-  // 000    TE      n/a         n/a       n/a     n/a     LJC=0 C=0
-  //-001-  -T-!E-  (no CATCH - no throw())
-  // 010    TCE     n/a         unreach.  n/a     n/a     LJC=0 C=0
-  //-011-  -TC!E-  (CATCH cannot be reached without a throw() in TRY)
-  // 100    T!E     LJC>0 C=0   n/a       n/a     n/a     LJC>0 C=0 >> rethrow
-  //-101-  -T!-!E- (no CATCH - no throw())
-  // 110    T!CE    LJC>0 C=0   LJC=0 C=1 n/a     n/a     LJC=0 C=1
-  // 111    T!C!E   LJC>0 C=0   LJC=0 C=1 LJC>0 C=1} LJC>0 C=2} LJC>0 C=2 >> r.
-  //
-  // FINALLY reduction:
-  // * Once entered sets C to a high value so even if FINALLY itself throws
-  //   then neither FINALLY nor CATCH blocks are re-entered
-  // * LJC isn't changed by FINALLY so that if a preceding CATCH has "unfired" an
-  //   exception (as in case 110) then it's not rethrown, else (case 111) it is
+static void putNumber(struct Out *out, uintmax_t u, char minus) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+
+  do {
+    *--p = '0' + u % 10;
+  } while (u /= 10);
 
-  if (hasUncatchable || _sxLastJumpCode) {
-    struct SxTraceEntry entry = {.code = _sxLastJumpCode, .line = line};
+  if (minus) { *--p = '-'; }
+  put(out, p, buf + sizeof(buf) - p);
+}
+
+static void putInt(struct Out *out, intmax_t value) {
+  putNumber(out, value < 0 ? -(uintmax_t) value : (uintmax_t) value,
+    value < 0);
+}
+
+// As a JSON string since JSON numbers may lose precision above 2^53.
+static void putHex(struct Out *out, uintptr_t value) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  *--p = '"';
+
+  do {
+    *--p = "0123456789abcdef"[value % 16];
+  } while (value /= 16);
+
+  *--p = 'x';
+  *--p = '0';
+  *--p = '"';
+  put(out, p, buf + sizeof(buf) - p);
+}
+
+// Only with 6 decimals, in exponent form from 9e12 (so that the scaled value
+// fits intmax_t) and as null if not finite (printf() is not
+// async-signal-safe).
+static void putDouble(struct Out *out, double value) {
+  double mag = value < 0 ? -value : value;
+  int exp = 0;
+
+  if (!(mag <= DBL_MAX)) {
+    PUT(out, "null");
+    return;
+  }
+
+  if (mag >= 9e12) {
+    for (; mag >= 10; exp++) { mag /= 10; }
+  }
+
+  intmax_t micro = (intmax_t) (mag * 1e6 + 0.5);
+  char frac[7] = "000000";
+
+  if (exp && micro >= 10000000) {   // 9.9999999e13 rounded to 10.
+    micro = 1000000;
+    exp++;
+  }
+
+  for (int i = 5, f = micro % 1000000; i >= 0; i--, f /= 10) {
+    frac[i] = '0' + f % 10;
+  }
 
-    snprintf(entry.message, SX_MAX_TRACE_STRING, "%srethrown by ENDTRY",
-      hasUncatchable ? "UNCATCHABLE " : "");
+  if (value < 0) { PUT(out, "-"); }
+  putInt(out, micro / 1000000);
+  PUT(out, ".");
+  put(out, frac, 6);
 
-    sxlcpy(entry.file, file);
-    _throw(entry);
+  if (exp) {
+    PUT(out, "e");
+    putInt(out, exp);
   }
 }
 
-// An arbitrary high value to bypass subsequent catch/catchall/finally.
-#define FINALLY_THRESHOLD 50
+static void putString(struct Out *out, const char *s) {
+  if (!s) {
+    PUT(out, "null");
+    return;
+  }
 
-char _sxSetCaught(char isFinally) {
-  sxAssert(nextContext > 0, EXIT_OUTSIDE_CAUGHT);
+  PUT(out, "\"");
 
-  struct TryContext *cx = &contexts[nextContext - 1];
-  const int caught = ++cx->caught;
+  for (; *s; s++) {
+    const unsigned char c = *s;
 
-  if (!isFinally) {   // a catch.
-    if (caught == 1) {
-      _sxLastJumpCode = 0;
-      return 1;
+    if (c == '"' || c == '\\') {
+      char esc[2] = {'\\', c};
+      put(out, esc, 2);
+    } else if (c < 0x20) {
+      char esc[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[c >> 4],
+        "0123456789abcdef"[c & 15]};
+      put(out, esc, 6);
+    } else {
+      put(out, s, 1);
+    }
+  }
+
+  PUT(out, "\"");
+}
+
+// A deferred sxprintf() is exported as its format and arguments.
+static void putDeferred(struct Out *out, const char *text) {
+  struct Deferred d;
+  memcpy(&d, text + 1, sizeof(d));
+  PUT(out, ",\"format\":");
+  putString(out, d.fmt);
+  PUT(out, ",\"args\":[");
+  char spec[16];
+  int i = 0;
+
+  for (const char *s = d.fmt; *s && i < d.count; ) {
+    const int type = nextSpec(&s, spec);
+    if (type == ARG_NONE) { continue; }
+    if (i) { PUT(out, ","); }
+
+    if (type & ARG_UNSIGNED) {
+      putNumber(out, d.args[i].u, 0);
+    } else if (type == ARG_DOUBLE) {
+      putDouble(out, d.args[i].d);
+    } else if (type == ARG_PTR) {
+      putHex(out, (uintptr_t) d.args[i].p);
+    } else {
+      putInt(out, d.args[i].i);
+    }
+
+    i++;
+  }
+
+  PUT(out, "]");
+}
+
+static void putEntry(struct Out *out, struct SxState *st,
+    const struct SxTraceEntry *entry) {
+  PUT(out, "{\"code\":");
+  putInt(out, entry->code);
+  PUT(out, ",\"uncatchable\":");
+  if (entry->uncatchable) { PUT(out, "true"); } else { PUT(out, "false"); }
+  PUT(out, ",\"file\":");
+  putString(out, entry->file);
+  PUT(out, ",\"line\":");
+  putInt(out, entry->line);
+  const char *message = entry->message;
+  const int row = isText(st, message)
+    ? (message - st->texts[0]) / SX_MAX_TRACE_STRING : -1;
+
+  if (row >= 0 && st->deferred[row] && message == st->texts[row]) {
+    putDeferred(out, message);
+  } else {
+    PUT(out, ",\"message\":");
+    putString(out, message);
+  }
+
+  if (entry->passed) {
+    PUT(out, ",\"passed\":");
+    putInt(out, entry->passed);
+  }
+
+  PUT(out, "}");
+}
+
+int sxExportTrace(int fd) {
+  // At most PIPE_BUF (4096 on Linux) so that a write() to a pipe is atomic.
+  char buf[4096];
+  // Room for closing the record after the last entry that fits.
+  struct Out out = {buf, buf + sizeof(buf) - 32, 0};
+  // Not _sxGetState(): it may allocate.
+  struct SxState *st = _sxState;
+
+  PUT(&out, "{\"tag\":");
+  putString(&out, sxTag);
+  PUT(&out, ",\"trace\":[");
+
+  for (int i = 0; st && i < st->nextTrace && !out.full; i++) {
+    char *const mark = out.p;
+    if (i) { PUT(&out, ","); }
+    putEntry(&out, st, &st->trace[i]);
+    if (out.full) { out.p = mark; }
+  }
+
+  PUT(&out, "]");
+
+#if SX_BACKTRACE
+  if (st && st->backtraceSize && !out.full) {
+    char *const mark = out.p;
+    PUT(&out, ",\"backtrace\":[");
+
+    for (int i = 0; i < st->backtraceSize; i++) {
+      if (i) { PUT(&out, ","); }
+      putHex(&out, (uintptr_t) st->backtrace[i]);
     }
-  } else {          // a finally.
-    if (caught < FINALLY_THRESHOLD) {
-      return cx->caught = FINALLY_THRESHOLD;
+
+    PUT(&out, "]");
+    if (out.full) { out.p = mark; }
+  }
+#endif
+
+  out.end = buf + sizeof(buf);
+  if (out.full) { PUT(&out, ",\"truncated\":true"); }
+  PUT(&out, "}\n");
+
+  for (const char *p = buf; p < out.p; ) {
+    const int n = write(fd, p, out.p - p);
+
+    if (n < 0 && errno != EINTR) {
+      return -1;
     }
+
+    if (n > 0) { p += n; }
   }
 
   return 0;
 }
 
-static void clearTrace() {
-  hasUncatchable = 0;
+static void vformat(struct SxTraceEntry *entry, const char *fmt, va_list arg) {
+  struct SxState *st = _sxGetState();
+  const int row = SX_MAX_TRACE + st->nextScratch;
+  char *text = st->texts[row];
+  st->nextScratch = (st->nextScratch + 1) % SX_MAX_SCRATCH;
+  entry->message = text;
+
+  struct Deferred d;
 
-  while (nextTrace > 0) {
-    void *extra = trace[--nextTrace].extra;
-    if (extra != NULL) { free(extra); }
+  if (CAN_DEFER && captureArgs(&d, fmt, arg)) {
+    text[0] = '\0';
+    memcpy(text + 1, &d, sizeof(d));
+    st->deferred[row] = 1;
+    return;
   }
+
+  // On an encoding error the buffer's contents are unspecified.
+  if (vsnprintf(text, SX_MAX_TRACE_STRING, fmt, arg) < 0) { text[0] = '\0'; }
+  st->deferred[row] = 0;
 }
 
-/*
-  try {             if (setjmp() == 0) {
-    throw(e);      >> line (1) > (3) > implicit rethrow()
-  } endtry          } _sxLeaveTry();
-*/
-SX_NORETURN void sxThrow(const struct SxTraceEntry entry) {
-  clearTrace();
-  _throw(entry);
+struct SxTraceEntry sxprintf(struct SxTraceEntry entry, const char *fmt, ...) {
+  va_list arg;
+
+  va_start(arg, fmt);
+  vformat(&entry, fmt, arg);
+  va_end(arg);
+
+  return entry;
 }
 
-SX_NORETURN void sxRethrow(const struct SxTraceEntry entry) {
-  sxAssert(nextContext > 0 &&
-    // catch resets _sxLastJumpCode on enter so rethrow() will get zero.
-    !_sxLastJumpCode &&
-    // Detect rethrow() inside finally.
-    contexts[nextContext - 1].caught < FINALLY_THRESHOLD,
-    EXIT_OUTSIDE_RETHROW);
+struct SxTraceEntry *sxprintfp(struct SxTraceEntry *entry, const char *fmt, ...) {
+  va_list arg;
+
+  va_start(arg, fmt);
+  vformat(entry, fmt, arg);
+  va_end(arg);
+
+  return entry;
+}
+
+void *sxAttach(struct SxTraceEntry *entry, size_t size) {
+  struct SxState *st = _sxGetState();
+  void *extra;
+
+  if (size <= SX_MAX_PAYLOAD) {
+    entry->extraKind = SX_EXTRA_INLINE;
+    extra = &st->payloads[SX_MAX_TRACE + st->nextPayload];
+    st->nextPayload = (st->nextPayload + 1) % SX_MAX_SCRATCH;
+  } else if (size <= SX_POOL_BLOCK) {
+    entry->extraKind = SX_EXTRA_POOL;
+
+    if (st->pool) {
+      extra = st->pool;
+      st->pool = *(void **) extra;
+    } else {
+      extra = malloc(SX_POOL_BLOCK);
+      _sxAssert(extra != NULL, EXIT_NO_MEMORY);
+    }
+  } else {
+    entry->extraKind = SX_EXTRA_MALLOC;
+    extra = malloc(size);
+    _sxAssert(extra != NULL, EXIT_NO_MEMORY);
+  }
+
+  entry->extraSize = size;
+  return entry->extra = extra;
+}
+
+void *sxCurrentExtra(size_t size) {
+  const struct SxTraceEntry *entry = sxCurrentExceptionPtr();
+
+  return entry && (!entry->extraSize || entry->extraSize >= size)
+    ? entry->extra : NULL;
+}
+
+void sxAddTraceEntry(const struct SxTraceEntry entry) {
+  sxAddTraceEntryPtr(&entry);
+}
+
+// Calls extraDel and frees or returns to the pool the payload of entry.
+static void releaseExtra(struct SxState *st, const struct SxTraceEntry *entry) {
+  void *extra = entry->extra;
+
+  if (extra != NULL) {
+    if (entry->extraDel) { entry->extraDel(extra); }
+
+    switch (entry->extraKind) {
+    case SX_EXTRA_MALLOC:
+      free(extra);
+      break;
+    case SX_EXTRA_POOL:
+      *(void **) extra = st->pool;
+      st->pool = extra;
+      break;
+    }
+  }
+}
+
+// Releases the payload of an entry not (or no longer) in the trace, unless
+// it's that of an entry in the trace (e.g. rethrow(curex()) shares it). Called
+// for every entry on clearing and for a new one dropped because the trace is
+// full - else its pool or malloc() block would leak.
+static void dropEntry(struct SxState *st, const struct SxTraceEntry *entry) {
+  for (int i = 0; i < st->nextTrace; i++) {
+    if (st->trace[i].extra == entry->extra) { return; }
+  }
+
+  releaseExtra(st, entry);
+}
+
+void sxDetach(struct SxTraceEntry *entry) {
+  if (entry->extra) {
+    dropEntry(_sxGetState(), entry);
+    entry->extra = NULL;
+    entry->extraSize = 0;
+    entry->extraDel = NULL;
+  }
+}
+
+void sxAddTraceEntryPtr(const struct SxTraceEntry *entry) {
+  struct SxState *st = _sxGetState();
+
+  // trace[0] is the first stack frame - it has initiated the exception.
+  if (st->nextTrace < SX_MAX_TRACE &&
+      (entry->file || entry->message || entry->extra)) {
+    struct SxTraceEntry *te = &st->trace[st->nextTrace];
+    char *text = st->texts[st->nextTrace];
+    // entry may be te itself (e.g. rethrowp(curexp()) when it's the only one).
+    if (te != entry) { *te = *entry; }
+    te->passed = 0;
+
+    // Text of a scratch row or another entry (e.g. of curex()) is copied to
+    // this entry's row. Rows don't overlap and sxlcpyn() copies forward so
+    // it's also safe if message points inside text. A deferred row is copied
+    // whole since it's not a string.
+    if (isText(st, te->message) && te->message != text) {
+      const int row = (te->message - st->texts[0]) / SX_MAX_TRACE_STRING;
+
+      if (st->deferred[row] && te->message == st->texts[row]) {
+        memcpy(text, te->message, SX_MAX_TRACE_STRING);
+        st->deferred[st->nextTrace] = 1;
+      } else {
+        sxlcpy(text, te->message);
+        st->deferred[st->nextTrace] = 0;
+      }
+
+      te->message = text;
+    }
+
+    // Likewise an inline payload of a scratch row (or of a row just cleared
+    // by throw(curex())) goes to this entry's row; memmove() because it may be
+    // already there. One of another entry (e.g. of rethrow(curex())) is
+    // referenced, not copied, so that the payload has one owner like a pool
+    // or malloc() one.
+    if (te->extraKind == SX_EXTRA_INLINE && te->extra &&
+        !isTracePayload(st, te->extra)) {
+      union SxPayload *payload = &st->payloads[st->nextTrace];
+      memmove(payload, te->extra, te->extraSize);
+      te->extra = payload;
+    }
+
+    st->nextTrace++;
+  } else if (entry->extra) {
+    dropEntry(st, entry);
+  }
+}
+
+// Sets site->known after hasCatch and hasFinally were set by the same thread so
+// another thread seeing known sees them too.
+static void setKnown(struct SxTrySite *site) {
+#ifdef __GNUC__
+  __atomic_store_n(&site->known, 1, __ATOMIC_RELEASE);
+#else
+  site->known = 1;
+#endif
+}
+
+// Once known, hasCatch and hasFinally of site are final.
+static char isKnown(const struct SxTrySite *site) {
+#ifdef __GNUC__
+  return __atomic_load_n(&site->known, __ATOMIC_ACQUIRE);
+#else
+  return site->known;
+#endif
+}
+
+// Reads a flag that other threads may be setting (see _sxMarkSite()).
+#ifdef __GNUC__
+#define SITE_HAS(site, flag) __atomic_load_n(&(site)->flag, __ATOMIC_RELAXED)
+#else
+#define SITE_HAS(site, flag) ((site)->flag)
+#endif
+
+static char canSkip(const struct SxTrySite *site) {
+  return isKnown(site) && !SITE_HAS(site, hasCatch) &&
+    !SITE_HAS(site, hasFinally);
+}
 
-  struct SxTraceEntry entryCopy = entry;
+// Asks the tryif() filter of the try at depth. *f is the number of filter
+// records that may belong to it or shallower tries; it's moved past the one
+// asked. Returns 1 if the filter accepted, 0 if declined, -1 if there's none.
+static int askFilter(struct SxState *st, int depth, int *f, int code) {
+  while (*f > 0 && st->filters[*f - 1].context > depth) { --*f; }
 
-  if (entry.code < 1) {
-    entryCopy.code = _sxLastJumpCode;
+  if (*f < 1 || st->filters[*f - 1].context != depth) {
+    return -1;
   }
 
-  _throw(entryCopy);
+  const struct SxTryFilter *rec = &st->filters[--*f];
+  return rec->func(code, sxCurrentExceptionPtr(), rec->data) != 0;
 }
+
+// Returns 0 if none of the entered tries can catch the exception: each has no
+// catch (as seen before) or a filter declining it. The topmost one is not
+// checked if skipTop.
+static char mayBeCaught(struct SxState *st, int f, int code, char skipTop) {
+  struct SxTrySegment *seg = st->segment;
+  struct SxTryContext *cx = st->nextFree;
+
+  for (int depth = st->nextContext; depth > 0; depth--) {
+    if (cx == seg->contexts) {
+      seg = seg->prev;
+      cx = seg->contexts + seg->size;
+    }
+
+    cx--;
+
+    if (depth == st->nextContext && skipTop) {
+      continue;
+    } else if (!isKnown(cx->site)) {
+      return 1;
+    } else if (askFilter(st, depth, &f, code) &&
+               SITE_HAS(cx->site, hasCatch)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Prints and exports the trace of an exception that won't be caught. If early,
+// finally blocks and deferred functions are yet to run and one of them may
+// throw an exception that is caught, so it's not said to be terminating.
+static void reportUncaught(struct SxState *st, int code, char early) {
+  if (early) {
+    fprintf(stderr, "Exception (code %d) won't be caught - reported before"
+      " finally blocks. Tag: %s\n", code, sxTag);
+  } else {
+    fprintf(stderr, "Uncaught exception (code %d) - terminating. Tag: %s\n",
+      code, sxTag);
+  }
+
+  sxPrintTrace();
+  if (sxExportFd >= 0) { sxExportTrace(sxExportFd); }
+  st->reported = 1;
+}
+
+// Jumps to the innermost try that may handle the exception, or terminates.
+// Tries that certainly won't (no catch and finally, or declined by a filter
+// and no finally) are passed without jumping.
+SX_NORETURN static void unwind(struct SxState *st, int code) {
+  const int jumpCode = code > 0 ? code : 1;
+  int passed = 0;
+  int f = st->nextFilter;
+  char declined = 0;
+
+  while (st->nextContext > 0) {
+    const struct SxTrySite *site = _sxTopContext(st)->site;
+
+    if (!canSkip(site)) {
+      if (st->leaving || askFilter(st, st->nextContext, &f, jumpCode)) {
+        break;
+      } else if (!isKnown(site) || SITE_HAS(site, hasFinally)) {
+        // Only to run the finally.
+        declined = 1;
+        break;
+      }
+    }
+
+    _sxPopContext(st);
+    passed++;
+  }
+
+  if (passed && st->nextTrace > 0) {
+    st->trace[st->nextTrace - 1].passed += passed;
+  }
+
+  _sxEvent(SX_EVENT_UNWIND, st, code, passed, NULL, 0, NULL);
+
+  if (st->nextContext < 1) {
+    // No wrapping try..catch block so this is an "uncaught exception".
+    if (st->reported) {
+      fprintf(stderr, "Uncaught exception (code %d) - terminating (trace"
+        " above). Tag: %s\n", code, sxTag);
+    } else {
+      reportUncaught(st, code, 0);
+    }
+
+    int exitCode = EXIT_UNCAUGHT + code;
+    exit(exitCode > 254 ? 254 : exitCode);
+  }
+
+  // Report before finally blocks and deferred functions change the state
+  // that has led to the exception.
+  if (!st->leaving && !st->reported &&
+      !mayBeCaught(st, f, jumpCode, declined)) {
+    reportUncaught(st, code, 1);
+  }
+
+  struct SxTryContext *cx = _sxTopContext(st);
+  cx->jumped = 1;
+
+  if (declined) {
+    // As if a catch was entered so that none is.
+    cx->caught = 1;
+    st->declinedContext = st->nextContext;
+  }
+
+  // Records above the target try belong to the functions or blocks being
+  // unwound; their stack is still intact.
+  if (st->nextDefer > cx->deferMark) {
+    _sxRunDefers(st, cx->deferMark);
+  }
+
+#ifdef SX_TELEMETRY
+  cx->thrown = st->throwTime;
+#endif
+
+  st->lastJumpCode = code > 0 ? code : 1;
+  _sxLongJmp( cx->buf );
+}
+
+SX_NORETURN static void _throw(const struct SxTraceEntry *entry) {
+  struct SxState *st = _sxGetState();
+  _sxEvent(SX_EVENT_THROW, st, entry->code, st->nextTrace, entry->file,
+    entry->line, entry->message);
+  sxAddTraceEntryPtr(entry);
+  st->hasUncatchable |= entry->uncatchable;
+
+  unwind(st, entry->code);
+}
+
+// Called when segment is full (or not yet assigned) - a cold path.
+void _sxNextSegment(struct SxState *st) {
+  struct SxTrySegment *next = st->segment ? st->segment->next : NULL;
+
+  if (!next) {
+    const int size = st->segment ? SX_TRY_SEGMENT : SX_FIRST_SEGMENT;
+    next = malloc(sizeof(*next) + size * sizeof(next->contexts[0]));
+    _sxAssert(next != NULL, EXIT_MAX_TRIES);
+    next->prev = st->segment;
+    next->next = NULL;
+    next->size = size;
+    if (st->segment) { st->segment->next = next; }
+  }
+
+  st->segment = next;
+  st->nextFree = next->contexts;
+  st->segmentEnd = next->contexts + next->size;
+}
+
+void _sxGrowDefers(struct SxState *st) {
+  const int max = st->maxDefers ? st->maxDefers * 2 : 32;
+  struct SxDeferRecord *defers = realloc(st->defers, max * sizeof(*defers));
+  _sxAssert(defers != NULL, EXIT_NO_MEMORY);
+  st->defers = defers;
+  st->maxDefers = max;
+}
+
+// Each record is removed before calling it so that if it throws, unwinding
+// continues with the next one.
+void _sxRunDefers(struct SxState *st, int depth) {
+  while (st->nextDefer > depth) {
+    const struct SxDeferRecord rec = st->defers[--st->nextDefer];
+    rec.func(rec.ptr);
+  }
+}
+
+int sxDeferDepth(void) {
+  return _sxGetState()->nextDefer;
+}
+
+void sxUndefer(int depth, char run) {
+  struct SxState *st = _sxGetState();
+
+  if (run) {
+    _sxRunDefers(st, depth);
+  } else if (st->nextDefer > depth) {
+    st->nextDefer = depth;
+  }
+}
+
+// Message of SX_TIMEOUT; enddeadline recognizes the exception by its address.
+static const char timeoutMessage[] = "Deadline exceeded";
+
+// The clock of deadlines in ns. The coarse clock is read from memory shared
+// with the kernel (no system call) and is good enough for budgets of ms.
+static long long deadlineNow(void) {
+  struct timespec ts;
+#if defined(CLOCK_MONOTONIC_COARSE)
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#elif defined(CLOCK_MONOTONIC)
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  timespec_get(&ts, TIME_UTC);
+#endif
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Makes room for one more record in an array of *max records of size bytes.
+static void *growArray(void *array, int *max, size_t size) {
+  const int n = *max ? *max * 2 : 8;
+  array = realloc(array, n * size);
+  _sxAssert(array != NULL, EXIT_NO_MEMORY);
+  *max = n;
+  return array;
+}
+
+static void popFilter(void *ptr) {
+  ((struct SxState *) ptr)->nextFilter--;
+}
+
+// Called by tryif right after its try was entered; like deadlines, the record
+// is popped by an sxDefer() of that try (i.e. before it's jumped to).
+char _sxEnterFilter(SxFilter *func, void *data) {
+  struct SxState *st = _sxGetState();
+
+  if (st->nextFilter == st->maxFilters) {
+    st->filters = growArray(st->filters, &st->maxFilters,
+      sizeof(*st->filters));
+  }
+
+  struct SxTryFilter *rec = &st->filters[st->nextFilter++];
+  rec->func = func;
+  rec->data = data;
+  rec->context = st->nextContext;
+  sxDefer(popFilter, st);
+  return 1;
+}
+
+static void popDeadline(void *ptr) {
+  ((struct SxState *) ptr)->nextDeadline--;
+}
+
+// Called by deadline right after its try was entered; the record is popped by
+// an sxDefer() of that try.
+char _sxEnterDeadline(long long ns, char catchable) {
+  struct SxState *st = _sxGetState();
+
+  if (st->nextDeadline == st->maxDeadlines) {
+    st->deadlines = growArray(st->deadlines, &st->maxDeadlines,
+      sizeof(*st->deadlines));
+  }
+
+  const long long now = deadlineNow();
+  long long at = ns > LLONG_MAX - now ? LLONG_MAX : now + ns;
+
+  if (st->nextDeadline && st->deadlines[st->nextDeadline - 1].at < at) {
+    at = st->deadlines[st->nextDeadline - 1].at;
+  }
+
+  struct SxDeadline *dl = &st->deadlines[st->nextDeadline++];
+  dl->at = at;
+  dl->context = st->nextContext;
+  dl->catchable = catchable;
+  sxDefer(popDeadline, st);
+  return 1;
+}
+
+void _sxCheckClock(struct SxState *st, const char *file, int line) {
+  const long long now = deadlineNow();
+
+  if (now >= st->deadlines[st->nextDeadline - 1].at) {
+    // The outermost passed scope is the one to abandon (inner ones have
+    // passed too since they're never later).
+    int i = 0;
+    while (st->deadlines[i].at > now) { i++; }
+
+    struct SxTraceEntry entry = {
+      .code         = SX_TIMEOUT,
+      .uncatchable  = !st->deadlines[i].catchable,
+      .file         = file,
+      .line         = line,
+      .message      = timeoutMessage,
+    };
+
+    st->timeoutContext = st->deadlines[i].context;
+    sxThrowPtr(&entry);
+  }
+}
+
+// Called by enddeadline of the scope that the last timeout belonged to.
+void _sxCatchTimeout(struct SxState *st) {
+  if ((st->hasUncatchable || st->lastJumpCode) && st->nextTrace > 0 &&
+      st->trace[0].message == timeoutMessage) {
+    st->hasUncatchable = 0;
+    st->lastJumpCode = 0;
+  }
+
+  st->timeoutContext = 0;
+}
+
+#define CHUNK_HEADER \
+  ((sizeof(struct SxRegionChunk) + 15) & ~(size_t) 15)
+
+static char *chunkData(struct SxRegionChunk *chunk) {
+  return (char *) chunk + CHUNK_HEADER;
+}
+
+// Moves to the next chunk that fits size (rounded like sxalloc() does),
+// allocating it if there's none. The rest of the current chunk is left unused.
+void *_sxGrowRegion(struct SxState *st, size_t size) {
+  // Neither the rounding nor CHUNK_HEADER + size may wrap around.
+  _sxAssert(size <= SIZE_MAX - CHUNK_HEADER - 15, EXIT_NO_MEMORY);
+  size = (size + 15 + !size) & ~(size_t) 15;
+  struct SxRegionChunk *next =
+    st->regionChunk ? st->regionChunk->next : st->regionFirst;
+
+  if (!next || (size_t) (next->end - chunkData(next)) < size) {
+    const size_t bytes = CHUNK_HEADER + size > SX_REGION_CHUNK
+      ? CHUNK_HEADER + size : SX_REGION_CHUNK;
+    struct SxRegionChunk *chunk = malloc(bytes);
+    _sxAssert(chunk != NULL, EXIT_NO_MEMORY);
+    chunk->end = (char *) chunk + bytes;
+    // Insert before next (that is too small or NULL).
+    chunk->prev = st->regionChunk;
+    chunk->next = next;
+    if (next) { next->prev = chunk; }
+
+    if (st->regionChunk) {
+      st->regionChunk->next = chunk;
+    } else {
+      st->regionFirst = chunk;
+    }
+
+    next = chunk;
+  }
+
+  st->regionChunk = next;
+  st->regionTop = chunkData(next) + size;
+  st->regionEnd = next->end;
+  return chunkData(next);
+}
+
+// mark is a former regionTop so it's in the current or a preceding chunk.
+void _sxResetRegion(struct SxState *st, char *mark) {
+  struct SxRegionChunk *chunk = st->regionChunk;
+
+  if (!mark) {
+    chunk = NULL;
+  } else {
+    while ((uintptr_t) mark - (uintptr_t) chunkData(chunk) >
+           (uintptr_t) (chunk->end - chunkData(chunk))) {
+      chunk = chunk->prev;
+    }
+  }
+
+  st->regionChunk = chunk;
+  st->regionTop = mark;
+  st->regionEnd = chunk ? chunk->end : NULL;
+}
+
+// Called by _sxLeaveTry() when the exception is still not handled. Also when
+// a try nested in a finally has completed during an uncatchable exception,
+// so the site is known only if the try was jumped to (a try that wasn't may
+// not have reached its catch).
+SX_NORETURN void _sxLeaveTryThrow(struct SxTrySite *site, char jumped,
+    const char *file, int line) {
+  struct SxState *st = _sxGetState();
+  if (jumped) { setKnown(site); }
+
+  // Possible cases:
+  // * (T)RY - always present
+  // * (!)throw within TRY - yes/no
+  // * (C)ATCH - yes/no (only considering a matching N or CATCHALL)
+  // * (!)throw within CATCH - yes/no
+  // * FINALLY - no (discussed layer)
+  // * (E)NDTRY - always present
+  //
+  //   2TRY     = state at setjmp() returning != 0 first time
+  //   1CATCH   = first time to CATCH (_sxSetCaught())
+  //   LJC      = _sxLastJumpCode
+  //   C        = caught
+  //   unreach. = never called
+  //
+  //                2TRY        1CATCH    3TRY    2CATCH  ENDTRY
+  // 000    TE      n/a         n/a       n/a     n/a     LJC=0 C=0
+  //-001-  -T-!E-  (no CATCH - no throw())
+  // 010    TCE     n/a         unreach.  n/a     n/a     LJC=0 C=0
+  //-011-  -TC!E-  (CATCH cannot be reached without a throw() in TRY)
+  // 100    T!E     LJC>0 C=0   n/a       n/a     n/a     LJC>0 C=0 >> rethrow
+  //-101-  -T!-!E- (no CATCH - no throw())
+  // 110    T!CE    LJC>0 C=0   LJC=0 C=1 n/a     n/a     LJC=0 C=1
+  // 111    T!C!E   LJC>0 C=0   LJC=0 C=1 LJC>0 C=1} LJC>0 C=2} LJC>0 C=2 >> r.
+  //
+  // FINALLY reduction:
+  // * Once entered sets C to a high value so even if FINALLY itself throws
+  //   then neither FINALLY nor CATCH blocks are re-entered
+  // * LJC isn't changed by FINALLY so that if a preceding CATCH has "unfired" an
+  //   exception (as in case 110) then it's not rethrown, else (case 111) it is
+
+  if (st->leaving) {
+    unwind(st, st->lastJumpCode);
+  }
+
+  // A plain try..endtry or one whose filter has declined the exception -
+  // only count it. Next time unwind() will skip the former.
+  const char declined = st->declinedContext == st->nextContext + 1;
+
+  if ((declined || (!SITE_HAS(site, hasCatch) &&
+                    !SITE_HAS(site, hasFinally))) &&
+      st->nextTrace > 0) {
+    st->declinedContext = 0;
+    st->trace[st->nextTrace - 1].passed++;
+    unwind(st, st->lastJumpCode);
+  }
+
+  struct SxTraceEntry entry = {
+    // An uncatchable exception keeps its code even if a catch has reset it.
+    .code     = st->lastJumpCode || st->nextTrace < 1
+      ? st->lastJumpCode : st->trace[0].code,
+    .file     = file,
+    .line     = line,
+    .message  = st->hasUncatchable
+      ? "UNCATCHABLE rethrown by ENDTRY" : "rethrown by ENDTRY",
+  };
+
+  _throw(&entry);
+}
+
+#if SX_JUMP_BACKEND == SX_JUMP_ASM
+// _sxAsmSetJmp(buf) stores the registers that the ABI requires a callee to
+// preserve plus the caller's stack pointer and return address; returns 0.
+// _sxAsmLongJmp(buf) restores them and "returns" 1 from that _sxAsmSetJmp().
+#if defined(__x86_64__)
+__asm__(
+  ".text\n"
+  ".globl _sxAsmSetJmp\n"
+  ".type _sxAsmSetJmp, @function\n"
+  "_sxAsmSetJmp:\n"
+  "  movq %rbx, 0(%rdi)\n"
+  "  movq %rbp, 8(%rdi)\n"
+  "  movq %r12, 16(%rdi)\n"
+  "  movq %r13, 24(%rdi)\n"
+  "  movq %r14, 32(%rdi)\n"
+  "  movq %r15, 40(%rdi)\n"
+  "  leaq 8(%rsp), %rdx\n"        // rsp as it will be after ret.
+  "  movq %rdx, 48(%rdi)\n"
+  "  movq (%rsp), %rdx\n"         // return address.
+  "  movq %rdx, 56(%rdi)\n"
+  "  xorl %eax, %eax\n"
+  "  ret\n"
+  ".size _sxAsmSetJmp, .-_sxAsmSetJmp\n"
+  ".globl _sxAsmLongJmp\n"
+  ".type _sxAsmLongJmp, @function\n"
+  "_sxAsmLongJmp:\n"
+  "  movq 0(%rdi), %rbx\n"
+  "  movq 8(%rdi), %rbp\n"
+  "  movq 16(%rdi), %r12\n"
+  "  movq 24(%rdi), %r13\n"
+  "  movq 32(%rdi), %r14\n"
+  "  movq 40(%rdi), %r15\n"
+  "  movq 48(%rdi), %rsp\n"
+  "  movl $1, %eax\n"
+  "  jmpq *56(%rdi)\n"
+  ".size _sxAsmLongJmp, .-_sxAsmLongJmp\n"
+);
+#elif defined(__aarch64__)
+__asm__(
+  ".text\n"
+  ".globl _sxAsmSetJmp\n"
+  ".type _sxAsmSetJmp, %function\n"
+  "_sxAsmSetJmp:\n"
+  "  stp x19, x20, [x0, #0]\n"
+  "  stp x21, x22, [x0, #16]\n"
+  "  stp x23, x24, [x0, #32]\n"
+  "  stp x25, x26, [x0, #48]\n"
+  "  stp x27, x28, [x0, #64]\n"
+  "  stp x29, x30, [x0, #80]\n"   // frame pointer and return address.
+  "  mov x16, sp\n"
+  "  str x16, [x0, #96]\n"
+  "  stp d8, d9, [x0, #104]\n"
+  "  stp d10, d11, [x0, #120]\n"
+  "  stp d12, d13, [x0, #136]\n"
+  "  stp d14, d15, [x0, #152]\n"
+  "  mov w0, #0\n"
+  "  ret\n"
+  ".size _sxAsmSetJmp, .-_sxAsmSetJmp\n"
+  ".globl _sxAsmLongJmp\n"
+  ".type _sxAsmLongJmp, %function\n"
+  "_sxAsmLongJmp:\n"
+  "  ldp x19, x20, [x0, #0]\n"
+  "  ldp x21, x22, [x0, #16]\n"
+  "  ldp x23, x24, [x0, #32]\n"
+  "  ldp x25, x26, [x0, #48]\n"
+  "  ldp x27, x28, [x0, #64]\n"
+  "  ldp x29, x30, [x0, #80]\n"
+  "  ldr x16, [x0, #96]\n"
+  "  mov sp, x16\n"
+  "  ldp d8, d9, [x0, #104]\n"
+  "  ldp d10, d11, [x0, #120]\n"
+  "  ldp d12, d13, [x0, #136]\n"
+  "  ldp d14, d15, [x0, #152]\n"
+  "  mov w0, #1\n"
+  "  ret\n"
+  ".size _sxAsmLongJmp, .-_sxAsmLongJmp\n"
+);
+#endif
+#endif
+
+#ifdef SX_TELEMETRY
+// Counters of one thread. Only that thread writes them (hence no locks), the
+// snapshot reads them with relaxed atomics. Blocks are never freed: when a
+// thread exits its block is marked unused and taken over by a new thread.
+struct TelemetryBlock {
+  struct TelemetryBlock *next;
+  char used;
+  unsigned long throws;
+  unsigned long catches;
+  unsigned long dropped;
+  unsigned long histogram[SX_HISTOGRAM];
+  // Open addressing by file and line; an entry is taken once file is set.
+  struct SxSiteStats throwSites[SX_TELEMETRY_SITES];
+  struct SxSiteStats catchSites[SX_TELEMETRY_SITES];
+};
+
+// All blocks ever allocated; only prepended to.
+static struct TelemetryBlock *telemetryBlocks;
+static SX_THREAD_LOCAL struct TelemetryBlock *threadTelemetry;
+
+static long long nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Returns this thread's block, taking an unused or a new one on first call.
+static struct TelemetryBlock *telemetryBlock(void) {
+  struct TelemetryBlock *block = threadTelemetry;
+
+  if (!block) {
+    for (block = LOAD(telemetryBlocks); block; block = block->next) {
+      char unused = 0;
+      if (CAS(block->used, unused, 1)) { break; }
+    }
+
+    if (!block) {
+      block = calloc(1, sizeof(*block));
+      _sxAssert(block != NULL, EXIT_NO_MEMORY);
+      block->used = 1;
+      block->next = LOAD(telemetryBlocks);
+      while (!CAS(telemetryBlocks, block->next, block)) ;
+    }
+
+    threadTelemetry = block;
+  }
+
+  return block;
+}
+
+// Sites are keyed by file name and line. The same __FILE__ may have different
+// addresses (e.g. in different units or without string merging) so names are
+// compared if the pointers differ, and only after the lines match.
+static char sameSite(const char *file, int line, const char *siteFile,
+    int siteLine) {
+  return line == siteLine && (file == siteFile || !strcmp(file, siteFile));
+}
+
+// Returns the entry for file:line in table or NULL if the table is full.
+// Hashes only line since file's address doesn't identify it (see sameSite()).
+static struct SxSiteStats *findSite(struct SxSiteStats *table,
+    const char *file, int line) {
+  if (!file) { file = "?"; }
+  unsigned i = (unsigned) line * 2654435761u % SX_TELEMETRY_SITES;
+
+  for (int n = 0; n < SX_TELEMETRY_SITES; n++) {
+    struct SxSiteStats *site = &table[i];
+
+    if (!site->file) {
+      // line is set first so that the snapshot never sees a half-filled key.
+      site->line = line;
+      STORE(site->file, file);
+      return site;
+    } else if (sameSite(file, line, site->file, site->line)) {
+      return site;
+    }
+
+    i = (i + 1) % SX_TELEMETRY_SITES;
+  }
+
+  return NULL;
+}
+
+// Called by sxThrow/Ptr() for a new exception (not for rethrows).
+static void countThrow(struct SxState *st, const struct SxTraceEntry *entry) {
+  struct TelemetryBlock *block = telemetryBlock();
+  struct SxSiteStats *site = findSite(block->throwSites, entry->file,
+    entry->line);
+  st->throwTime = nowNs();
+  BUMP(block->throws, 1);
+
+  if (site) {
+    BUMP(site->count, 1);
+  } else {
+    BUMP(block->dropped, 1);
+  }
+}
+
+// Called by _sxLeaveTry() of the try that handled an exception.
+void _sxCountCatch(long long thrown, const char *file, int line) {
+  struct TelemetryBlock *block = telemetryBlock();
+  struct SxSiteStats *site = findSite(block->catchSites, file, line);
+  const long long ns = nowNs() - thrown;
+  int bucket = 0;
+
+  while (bucket < SX_HISTOGRAM - 1 && ns >> (bucket + 1)) {
+    bucket++;
+  }
+
+  BUMP(block->catches, 1);
+  BUMP(block->histogram[bucket], 1);
+
+  if (site) {
+    BUMP(site->count, 1);
+    BUMP(site->ns, ns > 0 ? ns : 0);
+  } else {
+    BUMP(block->dropped, 1);
+  }
+}
+
+// Adds table's entries to the caller's array of *num (up to max) entries.
+static unsigned long mergeSites(const struct SxSiteStats *table,
+    struct SxSiteStats *sites, int *num, int max) {
+  unsigned long dropped = 0;
+
+  for (int i = 0; i < SX_TELEMETRY_SITES; i++) {
+    const char *file = LOAD(table[i].file);
+    if (!file) { continue; }
+    int j = 0;
+
+    while (j < *num &&
+           !sameSite(file, table[i].line, sites[j].file, sites[j].line)) {
+      j++;
+    }
+
+    if (j == *num) {
+      if (j == max) {
+        dropped++;
+        continue;
+      }
+
+      sites[j].file = file;
+      sites[j].line = table[i].line;
+      sites[j].count = sites[j].ns = 0;
+      ++*num;
+    }
+
+    sites[j].count += LOAD(table[i].count);
+    sites[j].ns += LOAD(table[i].ns);
+  }
+
+  return dropped;
+}
+
+void sxTelemetrySnapshot(struct SxTelemetry *t) {
+  t->numThrowSites = t->numCatchSites = 0;
+  t->throws = t->catches = t->dropped = 0;
+  memset(t->histogram, 0, sizeof(t->histogram));
+
+  for (struct TelemetryBlock *block = LOAD(telemetryBlocks); block;
+       block = block->next) {
+    t->throws += LOAD(block->throws);
+    t->catches += LOAD(block->catches);
+    t->dropped += LOAD(block->dropped);
+
+    for (int i = 0; i < SX_HISTOGRAM; i++) {
+      t->histogram[i] += LOAD(block->histogram[i]);
+    }
+
+    t->dropped += mergeSites(block->throwSites, t->throwSites,
+      &t->numThrowSites, t->maxThrowSites);
+    t->dropped += mergeSites(block->catchSites, t->catchSites,
+      &t->numCatchSites, t->maxCatchSites);
+  }
+}
+#endif
+
+#ifdef SX_RECORDER
+#if SX_RECORDER_EVENTS & (SX_RECORDER_EVENTS - 1)
+#error SX_RECORDER_EVENTS must be a power of 2.
+#endif
+
+#define RECORDER_SIZE \
+  (sizeof(struct SxRecorder) + SX_RECORDER_EVENTS * sizeof(struct SxEvent))
+
+static SX_THREAD_LOCAL struct SxRecorder *threadRecorder;
+static SX_THREAD_LOCAL char threadRecorderMapped;
+// PID and N of the thread's sxRecorderPath file, to unlink it on thread exit.
+static SX_THREAD_LOCAL int threadRecorderPid, threadRecorderFile;
+// Number of file names tried for sxRecorderPath by this process.
+static int recorderFiles;
+
+static void recorderFileName(char *path, size_t size, int pid, int n) {
+  snprintf(path, size, "%s.%d.%d", sxRecorderPath, pid, n);
+}
+
+// Returns a zeroed ring in a new sxRecorderPath file, or NULL on error. The
+// file is created anew (never truncated or written through a symlink that
+// someone has put in its place); an existing name is skipped.
+static struct SxRecorder *mapRecorder(void) {
+  const int pid = getpid();
+  char path[1024];
+  int fd, n;
+
+  for (int tries = 0; tries < 100; tries++) {
+    n = LOAD(recorderFiles);
+    while (!CAS(recorderFiles, n, n + 1)) ;
+    recorderFileName(path, sizeof(path), pid, n);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd >= 0 || errno != EEXIST) { break; }
+  }
+
+  if (fd < 0) { return NULL; }
+
+  void *map = ftruncate(fd, RECORDER_SIZE) ? MAP_FAILED
+    : mmap(NULL, RECORDER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    unlink(path);
+    return NULL;
+  }
+
+  threadRecorderPid = pid;
+  threadRecorderFile = n;
+  return map;
+}
+
+// Falls back to memory if sxRecorderPath is unset or can't be written.
+static struct SxRecorder *newRecorder(void) {
+  struct SxRecorder *rec = sxRecorderPath ? mapRecorder() : NULL;
+  threadRecorderMapped = rec != NULL;
+
+  if (!rec) {
+    rec = calloc(1, RECORDER_SIZE);
+    _sxAssert(rec != NULL, EXIT_NO_MEMORY);
+  }
+
+  memcpy(rec->magic, "SXREC1", 7);
+  rec->eventSize = sizeof(struct SxEvent);
+  rec->capacity = SX_RECORDER_EVENTS;
+  return threadRecorder = rec;
+}
+#endif
+
+#if defined(SX_VERBOSE) || defined(SX_RECORDER)
+// Copies the last size - 1 chars of src.
+static void copyTail(char *dest, const char *src, size_t size) {
+  if (!src) { src = ""; }
+  const size_t len = strlen(src);
+  sxlcpyn(dest, len < size ? src : src + len - (size - 1), size);
+}
+
+void _sxRecord(char kind, int depth, int code, int aux, const char *file,
+    int line, const char *text) {
+  struct SxEvent ev = {
+    .kind   = kind,
+    .depth  = depth,
+    .code   = code,
+    .aux    = aux,
+    .line   = line,
+  };
+
+  copyTail(ev.file, file, sizeof(ev.file));
+  sxlcpyn(ev.text, text ? text : "", sizeof(ev.text));
+
+#ifdef SX_RECORDER
+  struct SxRecorder *rec = threadRecorder ? threadRecorder : newRecorder();
+  const unsigned long long next = rec->next;
+  rec->events[next & (SX_RECORDER_EVENTS - 1)] = ev;
+  STORE(rec->next, next + 1);
+#endif
+
+#ifdef SX_VERBOSE
+  char buf[128];
+  sxFormatEvent(&ev, buf, sizeof(buf));
+  fprintf(stderr, "%s\n", buf);
+#endif
+}
+#endif
+
+struct SxRecorder *sxThreadRecorder(void) {
+#ifdef SX_RECORDER
+  return threadRecorder;
+#else
+  return NULL;
+#endif
+}
+
+int sxFormatEvent(const struct SxEvent *ev, char *buf, size_t size) {
+  // Strings of an event read from a file may lack '\0'.
+  const int fl = sizeof(ev->file);
+  const int tl = sizeof(ev->text);
+
+  switch (ev->kind) {
+  case SX_EVENT_ENTER:
+    return snprintf(buf, size, "% 3d _sxEnterTry2: code=%d caught=%d",
+      ev->depth, ev->code, ev->aux);
+  case SX_EVENT_CATCH:
+    return snprintf(buf, size, "% 3d catch:       code=%d caught=%d",
+      ev->depth, ev->code, ev->aux);
+  case SX_EVENT_FINALLY:
+    return snprintf(buf, size, "% 3d finally:     code=%d caught=%d",
+      ev->depth, ev->code, ev->aux);
+  case SX_EVENT_LEAVE:
+    return snprintf(buf, size, "% 3d _sxLeaveTry:  code=%d caught=%d "
+      "file=%.*s:%d", ev->depth, ev->code, ev->aux, fl, ev->file, ev->line);
+  case SX_EVENT_THROW:
+    return snprintf(buf, size, "% 3d %s code=%d file=%.*s:%d msg=%.*s",
+      ev->depth, ev->aux ? "rethrow:  " : "_throw:   ", ev->code,
+      fl, ev->file, ev->line, tl, ev->text);
+  case SX_EVENT_UNWIND:
+    return snprintf(buf, size, "% 3d unwind:    code=%d passed=%d",
+      ev->depth, ev->code, ev->aux);
+  default:
+    return snprintf(buf, size, "% 3d unknown event %d", ev->depth, ev->kind);
+  }
+}
+
+int sxPrintRecorder(const struct SxRecorder *rec, FILE *f) {
+  const int cap = rec->capacity;
+
+  if (memcmp(rec->magic, "SXREC1", 7) ||
+      rec->eventSize != sizeof(struct SxEvent) ||
+      cap < 1 || (cap & (cap - 1))) {
+    return -1;
+  }
+
+  const unsigned long long next = LOAD(rec->next);
+  const unsigned long long first = next > (unsigned) cap ? next - cap : 0;
+
+  for (unsigned long long i = first; i < next; i++) {
+    char buf[128];
+    sxFormatEvent(&rec->events[i & (cap - 1)], buf, sizeof(buf));
+    fprintf(f, "%s\n", buf);
+  }
+
+  return next - first;
+}
+
+#if SX_BACKTRACE
+// Stores return addresses starting from sxThrow/Ptr()'s caller (the first
+// skip frames are saneex' own). Stops at a frame pointer that doesn't look
+// valid: misaligned, not above the previous one or more than 1 MiB away
+// (e.g. a function built without -fno-omit-frame-pointer using it as a
+// general register) - which is cheap but not bullet-proof.
+#ifdef __GNUC__
+__attribute__ ((noinline))
+#endif
+static void captureBacktrace(struct SxState *st, int skip) {
+  int n = 0;
+
+#ifdef __GNUC__
+  void **fp = __builtin_frame_address(0);
+
+  while (n < SX_BACKTRACE && fp && fp[1]) {
+    if (skip) {
+      skip--;
+    } else {
+      st->backtrace[n++] = fp[1];
+    }
+
+    void **next = fp[0];
+
+    if (((uintptr_t) next & (sizeof(void *) - 1)) || next <= fp ||
+        (char *) next - (char *) fp > (1 << 20)) {
+      break;
+    }
+
+    fp = next;
+  }
+#endif
+
+  st->backtraceSize = n;
+}
+#endif
+
+// The payload keep (if not NULL) is not released: it's being thrown again
+// (e.g. throw(curex())) and the new entry takes it over.
+static void clearTrace(struct SxState *st, const void *keep) {
+  st->hasUncatchable = 0;
+  st->leaving = 0;
+  st->reported = 0;
+  st->declinedContext = 0;
+#if SX_BACKTRACE
+  st->backtraceSize = 0;
+#endif
+
+  while (st->nextTrace > 0) {
+    const struct SxTraceEntry *entry = &st->trace[--st->nextTrace];
+    if (!keep || entry->extra != keep) { dropEntry(st, entry); }
+  }
+}
+
+struct SxState *sxNewState(void) {
+  struct SxState *st = calloc(1, sizeof(*st));
+  _sxAssert(st != NULL, EXIT_NO_MEMORY);
+  return st;
+}
+
+struct SxState *sxSwitchState(struct SxState *st) {
+  struct SxState *prev = _sxGetState();
+
+  if (!st) {
+    st = _sxThreadState ? _sxThreadState : _sxInitState();
+  }
+
+  _sxState = st;
+  return prev;
+}
+
+// Frees everything st has allocated but not st itself.
+static void releaseState(struct SxState *st) {
+  clearTrace(st, NULL);
+  struct SxTrySegment *seg = st->segment;
+
+  while (seg && seg->prev) {
+    seg = seg->prev;
+  }
+
+  for (struct SxTrySegment *next; seg; seg = next) {
+    next = seg->next;
+    free(seg);
+  }
+
+  for (void *block = st->pool, *next; block; block = next) {
+    next = *(void **) block;
+    free(block);
+  }
+
+  for (struct SxRegionChunk *chunk = st->regionFirst, *next; chunk;
+       chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+
+  free(st->defers);
+  free(st->filters);
+  free(st->deadlines);
+}
+
+void sxFreeState(struct SxState *st) {
+  _sxAssert(st != _sxState && st != _sxThreadState && !st->nextContext,
+    EXIT_STATE_IN_USE);
+  releaseState(st);
+  free(st);
+}
+
+#if SX_THREAD_EXIT
+static tss_t threadStateKey;
+static once_flag threadStateOnce = ONCE_FLAG_INIT;
+
+// Called on thread exit with the state _sxInitState() made for that thread
+// (tries still entered, e.g. if thrd_exit() was called inside one, are just
+// dropped).
+static void freeThreadState(void *ptr) {
+  struct SxState *st = ptr;
+
+  if (_sxState == st) { _sxState = NULL; }
+  _sxThreadState = NULL;
+
+#ifdef SX_RECORDER
+  if (threadRecorderMapped) {
+    // The thread has ended normally so its events aren't needed post-mortem.
+    char path[1024];
+    recorderFileName(path, sizeof(path), threadRecorderPid,
+      threadRecorderFile);
+    unlink(path);
+    munmap(threadRecorder, RECORDER_SIZE);
+  } else {
+    free(threadRecorder);
+  }
+
+  threadRecorder = NULL;
+#endif
+
+#ifdef SX_TELEMETRY
+  if (threadTelemetry) {
+    STORE(threadTelemetry->used, 0);
+    threadTelemetry = NULL;
+  }
+#endif
+
+  releaseState(st);
+  free(st);
+}
+
+static void createThreadStateKey(void) {
+  const int res = tss_create(&threadStateKey, freeThreadState);
+  _sxAssert(res == thrd_success, EXIT_NO_MEMORY);
+}
+#endif
+
+// Called by _sxGetState() on the first use by this thread (or after
+// freeThreadState(), e.g. by another key's destructor).
+struct SxState *_sxInitState(void) {
+  if (!_sxThreadState) {
+    _sxThreadState = sxNewState();
+
+#if SX_THREAD_EXIT
+    call_once(&threadStateOnce, createThreadStateKey);
+    tss_set(threadStateKey, _sxThreadState);
+#endif
+  }
+
+  return _sxState = _sxThreadState;
+}
+
+/*
+  try {             if (setjmp() == 0) {
+    throw(e);      >> line (1) > (3) > implicit rethrow()
+  } endtry          } _sxLeaveTry();
+*/
+SX_NORETURN void sxThrow(const struct SxTraceEntry entry) {
+  struct SxState *st = _sxGetState();
+  clearTrace(st, entry.extra);
+#if SX_BACKTRACE
+  captureBacktrace(st, 1);
+#endif
+#ifdef SX_TELEMETRY
+  countThrow(st, &entry);
+#endif
+  _throw(&entry);
+}
+
+SX_NORETURN void sxThrowPtr(const struct SxTraceEntry *entry) {
+  struct SxState *st = _sxGetState();
+
+  if ((uintptr_t) entry - (uintptr_t) st->trace < sizeof(st->trace)) {
+    // E.g. throwp(curexp()) - clearTrace() is about to reuse entry's slot so
+    // it's copied; its payload is moved to the copy (not released).
+    sxThrow(*entry);
+  }
+
+  clearTrace(st, entry->extra);
+#if SX_BACKTRACE
+  captureBacktrace(st, 1);
+#endif
+#ifdef SX_TELEMETRY
+  countThrow(st, entry);
+#endif
+  _throw(entry);
+}
+
+SX_NORETURN void sxLeave(int code) {
+  struct SxState *st = _sxGetState();
+  clearTrace(st, NULL);
+  st->leaving = 1;
+#ifdef SX_TELEMETRY
+  st->throwTime = 0;   // leave() is neither a throw nor a catch.
+#endif
+  unwind(st, code);
+}
+
+SX_NORETURN void sxThrowResult(struct SxResult r, const char *file, int line) {
+  struct SxTraceEntry entry = {
+    .code     = r.code,
+    .file     = file,
+    .line     = line,
+    .message  = r.message,
+  };
+
+  sxThrowPtr(&entry);
+}
+
+char _sxCaptureResult(struct SxResult *r) {
+  struct SxState *st = _sxGetState();
+  r->code = st->lastJumpCode;
+  r->message = st->nextTrace > 0 ? sxMessage(&st->trace[0]) : "";
+  return 1;
+}
+
+SX_NORETURN void sxRethrow(const struct SxTraceEntry entry) {
+  sxRethrowPtr(&entry);
+}
+
+SX_NORETURN void sxRethrowPtr(const struct SxTraceEntry *entry) {
+  struct SxState *st = _sxGetState();
+  _sxAssert(st->nextContext > 0 &&
+    // catch resets lastJumpCode on enter so rethrow() will get zero.
+    !st->lastJumpCode &&
+    // Detect rethrow() inside finally.
+    _sxTopContext(st)->caught < SX_FINALLY_THRESHOLD,
+    EXIT_OUTSIDE_RETHROW);
+  // A caught leave() becomes a regular exception.
+  st->leaving = 0;
+
+  if (entry->code < 1) {
+    struct SxTraceEntry entryCopy = *entry;
+    entryCopy.code = st->lastJumpCode;
+    _throw(&entryCopy);
+  }
+
+  _throw(entry);
+}
+
+#ifdef SX_FAULTS
+static const int faultSignals[] = {SIGSEGV, SIGBUS, SIGFPE};
+static const char *const faultMessages[] =
+  {"Segmentation fault", "Bus error", "Arithmetic exception"};
+static struct sigaction previousActions[3];
+
+// Runs on the stack of the faulting code. The signal isn't blocked here
+// (SA_NODEFER) so that nothing has to restore the mask after unwind()'s jump
+// which doesn't restore it (unless SX_JUMP_SETJMP does on this libc).
+static void onFault(int sig, siginfo_t *info, void *context) {
+  int i = 0;
+  while (faultSignals[i] != sig) { i++; }
+  // Not _sxGetState() - a thread that has no state has no try either.
+  struct SxState *st = _sxState;
+
+  // si_code is <= 0 if the signal was sent by kill(), raise() and the like.
+  if (info->si_code > 0 && st && st->nextContext > 0) {
+    struct SxTraceEntry entry = {
+      .code     = SX_FAULT,
+      .message  = faultMessages[i],
+    };
+
+    struct SxFault *fault = sxAttach(&entry, sizeof(*fault));
+    fault->signal = sig;
+    fault->code = info->si_code;
+    fault->address = info->si_addr;
+    sxThrowPtr(&entry);
+  }
+
+  const struct sigaction *prev = &previousActions[i];
+
+  if (prev->sa_flags & SA_SIGINFO) {
+    prev->sa_sigaction(sig, info, context);
+  } else if (prev->sa_handler != SIG_DFL && prev->sa_handler != SIG_IGN) {
+    prev->sa_handler(sig);
+  } else if (prev->sa_handler == SIG_DFL || info->si_code > 0) {
+    // Returning would repeat a fault forever even if it's ignored.
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+}
+
+int sxCatchFaults(void) {
+  static char installed;
+  if (installed) { return 0; }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = onFault;
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+
+  for (int i = 0; i < 3; i++) {
+    if (sigaction(faultSignals[i], &action, &previousActions[i])) {
+      return -1;
+    }
+  }
+
+  installed = 1;
+  return 0;
+}
+#endif
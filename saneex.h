@@ -20,10 +20,15 @@ ______________________________________________________________________________
        This cannot be detected even on runtime and will result in state
        desynchronization and broken windows.
     2. Do not forget endtry. The compiler will warn you about 3 unclosed '}'.
+    3. try declares a static variable so it can't be used in inline functions
+       unless they're also static (C99 6.7.4).
 ______________________________________________________________________________
 
   Functions available inside catch() and catchall:
-    sxPrintTrace()        output current exception's trace to stderr
+    sxPrintTrace()        output current exception's trace (and backtrace)
+                          to stderr
+    sxCurrentBacktrace(&n)  return addresses where the exception was thrown
+    sxExportTrace(fd)     write the trace as one JSON line (async-signal-safe)
     sxPrintEntryToStdErr(TE, p)  output the given SxTraceEntry to stderr
     sxWalkTrace(func, p)  invoke func for all stack frames of the current ex.
     rethrow()             like throw() but preserve trace of the current ex.
@@ -31,9 +36,30 @@ ______________________________________________________________________________
   Functions available in all contexts:
     throw(SxTraceEntry)   throw an exception with additional parameters
     curex()               get current top-level trace entry, or code = -1
+    leave(code)           unwind to a catch(code) like throw() but without a
+                          trace, message or errno (cheap non-local exit)
     thrif(x, m)           throw an exception if x holds (m = "message")
     thri(x)               like thrif() but no message
+    thrres(r)             throw an exception if SxResult r has non-0 code
+    sxDefer(func, ptr)    call func(ptr) when leaving the enclosing try
+    sxDeferDepth()        number of sxDefer() records not yet called
+    sxUndefer(depth, run) pop (and call if run) records down to depth
+    sxalloc(size)         allocate memory that is freed by the enclosing endtry
     sxprintf(TE, fmt, ...)  return a copy of TE with sprintf()'d TE.message
+                          (the only way to set a non-static message)
+    sxMessage(&TE)        TE.message, formatting it first if it was deferred
+    sxAttach(&TE, size)   return size bytes for TE.extra without malloc()
+    sxDetach(&TE)         release TE.extra of an entry that won't be thrown
+    curextra(T)           current exception's extra as T*, or NULL
+    sxNewState()          allocate a separate state (e.g. for a fiber)
+    sxSwitchState(st)     make st this thread's state, return the former one
+    sxFreeState(st)       free a state made by sxNewState()
+    sxTelemetrySnapshot(&t)  throw/catch counts of all threads (SX_TELEMETRY)
+
+  Pointer-based equivalents (avoid copying SxTraceEntry through the stack):
+    throwp(&TE), rethrowp(&TE)   same as throw() and rethrow()
+    curexp()              pointer to the current top-level trace entry or NULL
+    sxprintfp(&TE, fmt, ...)  set TE.message in place, return &TE
 
   SxTraceEntry struct creation macros:
     newex()               set errno, __FILE__ and __LINE__ - "NEW EXception"
@@ -49,6 +75,163 @@ ______________________________________________________________________________
   won't be caught) which on runtime cannot be told apart from a "catching"
   try..catch block.
 
+  Many catch() are tested one by one. For constant codes a switch can be used
+  instead (it may follow catch() but not precede them or catchall; a break
+  inside catchcase leaves the switch, not an enclosing loop):
+
+    try {
+      ...
+    } catchswitch {
+      catchcase(N) {     << like catch(N) (N must be a constant expression)
+        ...
+      }
+      catchcase(M) {
+        ...
+      }
+      catchdefault {     << optional, like catchall
+        ...
+      }
+    } finally {
+      ...
+    } endtry
+
+  Where throwing is too costly (e.g. an error happens on most calls) return
+  struct SxResult and convert it where necessary, so the same code serves
+  both throwing and non-throwing callers:
+
+    struct SxResult lookup(const char *key, int *value) {
+      ...
+      return sxerr(notFound, "Key not found");
+    }
+
+    int lookupOrThrow(const char *key) {
+      int value;
+      thrres(lookup(key, &value));   << throw with this file/line if error
+      return value;
+    }
+
+    struct SxResult r;
+    capture(r) {                     << r gets code and message of an
+      ...                               exception thrown here (else sxok())
+    } endcapture
+
+  A try..finally only to free a resource costs a setjmp(). Any number of
+  cleanups can be instead registered with sxDefer() and run by one try:
+
+    try {
+      char *buf = malloc(size);
+      sxDefer(free, buf);
+      FILE *f = fopen(path, "r");
+      sxDefer((void (*)(void *)) fclose, f);
+      ...
+    } endtry             << fclose(f) and free(buf) are called here or
+                            before this try's catch/finally on exception
+
+  Functions can also run and pop own records early:
+
+    int depth = sxDeferDepth();
+    sxDefer(free, p);
+    ...
+    sxUndefer(depth, 1);
+
+  Deferred functions run while the stack of the throwing function still
+  exists so they can free on-stack objects. If one throws then the new
+  exception replaces the one being unwound (as when throwing from finally).
+
+  Temporary buffers can be taken from a per-thread region with sxalloc().
+  All allocations made since a try was entered are released at once by its
+  endtry (it just moves the region's top back):
+
+    try {
+      char *line = sxalloc(len + 1);
+      struct Item *items = sxalloc(count * sizeof(*items));
+      ...
+    } catchall {
+      ...                << line and items are still valid here
+    } endtry             << and freed here (both normally and on exception)
+
+  A handler that wants only some exceptions of a code shouldn't catch and
+  rethrow the rest (a jump and a trace entry per level). A try can instead
+  have a filter that is asked before unwinding even starts:
+
+    char isRetryable(int code, const struct SxTraceEntry *e, void *data) {
+      return code == netError && ((struct Conn *) data)->retries < 3;
+    }
+
+    tryif(isRetryable, conn) {
+      ...
+    } catchall {
+      ...                << only exceptions that isRetryable() accepted
+    } finally {
+      ...                << any exception (the catch blocks are skipped if
+    } endtry                the filter said no)
+
+  A try whose filter returns 0 is passed without jumping to it unless it has
+  a finally. Filters run while the stack of the throwing function still
+  exists, must not throw and may be called more than once per exception.
+
+  Since filters and the try..catch sites seen before tell which try blocks
+  can handle an exception, one that certainly won't be caught is reported
+  (see sxPrintTrace() and sxExportFd) before its finally blocks and sxDefer()
+  functions run. That report doesn't say the program terminates since one
+  of them may throw a new exception that is then caught; a short
+  "terminating" line follows once the exception reaches the bottom.
+
+  Work that may run over its time budget is put in a deadline scope and
+  checks it at points where it's safe to stop:
+
+    deadline(50 * 1000000) {       << 50 ms from now (or less if an outer
+      for (...) {                     deadline scope ends earlier)
+        sxCheckDeadline();         << throws SX_TIMEOUT once it has passed
+        ...
+      }
+    } catch(SX_TIMEOUT) {
+      ...                          << optional; runs if this scope timed out
+    } enddeadline                  << execution continues after this
+
+  The timeout is uncatchable: catch and finally blocks of the code inside
+  run but only the deadline scope whose own time has passed stops it.
+  deadlinex(ns, 1) makes a scope whose timeout is an ordinary exception that
+  the code inside may catch (and go on, to be stopped by the next check).
+  sxCheckDeadline() reads a coarse clock (CLOCK_MONOTONIC_COARSE where
+  available, no system call) so the deadline is noticed a few ms late.
+
+  With SX_FAULTS, sxCatchFaults() turns memory and arithmetic faults (SIGSEGV,
+  SIGBUS, SIGFPE) inside a try into exceptions, so e.g. a mapped file of
+  untrusted data can be read without bounds checks:
+
+    sxCatchFaults();        << once, e.g. in main()
+
+    try {
+      sum += ((volatile int *) data)[index];
+    } catch(SX_FAULT) {
+      struct SxFault *f = curextra(struct SxFault);
+      printf("signal %d at %p", f->signal, f->address);
+    } endtry
+
+  Only faults that the CPU raised (not kill() or raise()) while a try is
+  entered are thrown; others go to the handler that was set before (or the
+  default action). Code that may fault must use volatile or the compiler can
+  assume it doesn't (e.g. move a division out of the try). Faults inside
+  saneex or libc (malloc() and the like) and stack overflows can't be
+  recovered from.
+
+  All of the above (try contexts, trace, sxDefer() records, the sxalloc()
+  region, deadlines) is per-thread. A user-space scheduler running many
+  fibers on one thread gives each fiber own state and swaps it along with
+  the stack:
+
+    struct SxState *fiberState = sxNewState();
+    ...
+    // Switching to a fiber:
+    struct SxState *schedulerState = sxSwitchState(fiberState);
+    swapcontext(&scheduler, &fiber);
+    sxSwitchState(schedulerState);
+
+  Switching is a pointer assignment. A fiber resumed on another thread must
+  switch its state in there. Every try of a state must be on the stack that
+  it was switched in with.
+
   Exception codes can be either integer #define's or, better, enum members:
 
     enum {badArguments = 1, divisionByZero, userAbort} MyExceptionCodes;
@@ -63,14 +246,89 @@ ______________________________________________________________________________
   Overridable #defines:
     SX_ASSERT             use assert() instead of a check & exit() for run-time
                           state consistency checks (#define ignored if NDEBUG)
-    SX_VERBOSE            output debug information to stderr
+    SX_VERBOSE            output debug information (try/catch/throw events)
+                          to stderr
+    SX_RECORDER           keep the last SX_RECORDER_EVENTS events per thread
+                          in a binary ring (see sxThreadRecorder()); much
+                          cheaper than SX_VERBOSE, can be left on in production;
+                          kept in memory or in a file (see sxRecorderPath)
+    SX_RECORDER_EVENTS    capacity of the ring (a power of 2, default 1024)
+    SX_BACKTRACE          number of return addresses to keep when a new
+                          exception is thrown (default 0 - none); gcc/clang
+                          only, found by walking frame pointers so everything
+                          should be built with -fno-omit-frame-pointer; names
+                          are looked up only by sxPrintTrace() (with dladdr()
+                          where available so link with -rdynamic to see
+                          non-exported functions); must match in all units
     SX_THREAD_LOCAL       type qualifier for shared variables;
                           defaults to none (not thread-safe)
+    SX_TLS_MODEL          attribute for the thread-local state; when building
+                          a shared object try (gcc/clang):
+                          __attribute__ ((tls_model ("initial-exec")))
+                          (the object then can't be dlopen()'ed reliably)
     SX_NORETURN           function qualifier for compiler optimization
+    SX_MAX_TRACE          maximum number of entries in a trace (default 20)
+    SX_JUMP_BACKEND       how try saves and throw restores the context:
+                          SX_JUMP_SETJMP, SX_JUMP_NOSIGMASK, SX_JUMP_BUILTIN
+                          or SX_JUMP_ASM (see their #define-s below);
+                          SX_JUMP_NOSIGMASK needs sigsetjmp() declared, e.g.
+                          -D_POSIX_C_SOURCE=200809L with -std=c99/c11; must
+                          match in all units (it changes the size of the try
+                          context and throw restores what try saved)
+    SX_FIRST_SEGMENT      number of try contexts allocated by the first try
+                          (default 8)
+    SX_TRY_SEGMENT        number of contexts allocated at once when nesting
+                          gets deeper (default 32); all are kept for reuse
+    SX_THREAD_EXIT        1 to free a thread's state when the thread exits,
+                          0 to leave it; defaults to 1 if SX_THREAD_LOCAL is
+                          set and C11 threads are available (tss_create())
+    SX_DEFER_ARGS         maximum number of arguments that sxprintf() keeps to
+                          format the message only when it's needed (default 0
+                          - always formats right away); only if every fmt
+                          given to sxprintf() outlives the trace (a literal),
+                          see sxprintf()
+    SX_MAX_PAYLOAD        sxAttach() payloads up to this size are kept right
+                          in the trace (default 64 bytes)
+    SX_POOL_BLOCK         larger payloads up to this size come from a
+                          per-thread pool of reused blocks (default 1024)
+    SX_REGION_CHUNK       size of blocks malloc()'ed for sxalloc() (default
+                          64 KiB; larger allocations get own blocks); they're
+                          kept for reuse
+    SX_TELEMETRY          count throws per site (file:line of the thrown
+                          entry), catches per site (of the handling endtry)
+                          and time from throw to that endtry; see
+                          sxTelemetrySnapshot() (must match in all units)
+    SX_TELEMETRY_SITES    size of the per-thread site tables (default 256)
+    SX_FAULTS             provide sxCatchFaults() (POSIX only; must match
+                          in all units)
+    SX_FAULT              code of the exception thrown on a fault (default
+                          EFAULT)
+    SX_TIMEOUT            code of the exception thrown by sxCheckDeadline()
+                          (default ETIMEDOUT)
+    SX_INLINE             define before including saneex.h to have try, catch,
+                          finally and endtry inlined into the calling code
+                          (only uncommon paths call into saneex.c); can differ
+                          between translation units, saneex.c needs neither
+                          (but SX_THREAD_LOCAL must match, as must
+                          SX_MAX_TRACE, SX_MAX_TRACE_STRING, SX_MAX_PAYLOAD
+                          and SX_MAX_SCRATCH: they lay out struct SxState
+                          that inlined code and macros like catch() read
+                          directly; with gcc/clang a mismatch is found at
+                          startup, see EXIT_LAYOUT_MISMATCH)
 
   Variables:
     sxTag                 is output together with a trace; defaults to
                           compilation date/time; can be e.g. a program version
+    sxExportFd            if not -1 then on uncaught exception the trace is
+                          also written there by sxExportTrace()
+    sxRecorderPath        if set (with SX_RECORDER) then each thread's ring is
+                          an mmap()'ed file named "sxRecorderPath.PID.N" so it
+                          survives a crash; print it with saneex-recdump.c;
+                          a file is created on the thread's first event
+                          (skipping existing names, never following a
+                          symlink) and unlinked when the thread exits (only
+                          with SX_THREAD_EXIT); files of threads alive when
+                          the process exits or crashes are left
 ______________________________________________________________________________
 
   Attention!
@@ -107,6 +365,9 @@ ______________________________________________________________________________
 //#define SX_THREAD_LOCAL _Thread_local
 //#define SX_NORETURN __attribute__ ((noreturn))
 //#define SX_MAX_TRACE_STRING 32
+//#define SX_TRY_SEGMENT 16
+//#define SX_JUMP_BACKEND SX_JUMP_BUILTIN
+//#define SX_INLINE
 // If you have problems with default unprefixed aliases:
 //#undef throw
 //#define my_throw sxThrow
@@ -119,6 +380,20 @@ ______________________________________________________________________________
 #include <setjmp.h>
 #include <errno.h>
 
+#if defined(SX_ASSERT) && !defined(NDEBUG)
+#include <assert.h>
+#endif
+
+// Before SX_THREAD_LOCAL gets its default.
+#ifndef SX_THREAD_EXIT
+#if defined(SX_THREAD_LOCAL) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_THREADS__)
+#define SX_THREAD_EXIT        1
+#else
+#define SX_THREAD_EXIT        0
+#endif
+#endif
+
 #ifndef SX_THREAD_LOCAL
 #define SX_THREAD_LOCAL
 #endif
@@ -127,10 +402,129 @@ ______________________________________________________________________________
 #define SX_NORETURN
 #endif
 
+#ifndef SX_TLS_MODEL
+#define SX_TLS_MODEL
+#endif
+
 #ifndef SX_MAX_TRACE_STRING
 #define SX_MAX_TRACE_STRING   128
 #endif
 
+#ifndef SX_MAX_TRACE
+#define SX_MAX_TRACE          20
+#endif
+
+#ifndef SX_FAULT
+#ifdef EFAULT
+#define SX_FAULT              EFAULT
+#else
+#define SX_FAULT              14
+#endif
+#endif
+
+#ifndef SX_TIMEOUT
+#ifdef ETIMEDOUT
+#define SX_TIMEOUT            ETIMEDOUT
+#else
+#define SX_TIMEOUT            110
+#endif
+#endif
+
+// Number of buffers sxprintf() cycles through for entries not yet thrown.
+#ifndef SX_MAX_SCRATCH
+#define SX_MAX_SCRATCH        4
+#endif
+
+#ifndef SX_FIRST_SEGMENT
+#define SX_FIRST_SEGMENT      8
+#endif
+
+#ifndef SX_TRY_SEGMENT
+#define SX_TRY_SEGMENT        32
+#endif
+
+#ifndef SX_DEFER_ARGS
+#define SX_DEFER_ARGS         0
+#endif
+
+#ifndef SX_MAX_PAYLOAD
+#define SX_MAX_PAYLOAD        64
+#endif
+
+#ifndef SX_POOL_BLOCK
+#define SX_POOL_BLOCK         1024
+#endif
+
+#ifndef SX_REGION_CHUNK
+#define SX_REGION_CHUNK       65536
+#endif
+
+#ifndef SX_RECORDER_EVENTS
+#define SX_RECORDER_EVENTS    1024
+#endif
+
+#ifndef SX_BACKTRACE
+#define SX_BACKTRACE          0
+#endif
+
+#ifndef SX_TELEMETRY_SITES
+#define SX_TELEMETRY_SITES    256
+#endif
+
+// Number of SxTelemetry.histogram buckets.
+#define SX_HISTOGRAM          32
+
+// Values for SX_JUMP_BACKEND.
+#define SX_JUMP_SETJMP        1   // setjmp()/longjmp(), portable (default).
+#define SX_JUMP_NOSIGMASK     2   // sigsetjmp(b, 0)/siglongjmp(), POSIX.
+#define SX_JUMP_BUILTIN       3   // __builtin_setjmp()/longjmp(), gcc/clang.
+#define SX_JUMP_ASM           4   // hand-written, x86-64 SysV/aarch64 ELF.
+
+// Any backend works with SX_FAULTS since sxCatchFaults()' handler doesn't
+// block the signal that it leaves by a jump.
+#ifndef SX_JUMP_BACKEND
+#define SX_JUMP_BACKEND       SX_JUMP_SETJMP
+#endif
+
+// _sxSetJmp() returns 0 when saving the context and non-0 when it's restored
+// by _sxLongJmp(). The exception code is passed in _sxLastJumpCode rather than
+// as setjmp()'s result because __builtin_longjmp() can only pass 1.
+#if SX_JUMP_BACKEND == SX_JUMP_SETJMP
+typedef jmp_buf SxJmpBuf;
+#define _sxSetJmp(buf)        setjmp(buf)
+#define _sxLongJmp(buf)       longjmp(buf, 1)
+#elif SX_JUMP_BACKEND == SX_JUMP_NOSIGMASK
+// Some libcs (BSD, macOS) save the signal mask in setjmp() which costs a
+// syscall per try. sigsetjmp() is POSIX: strict -std=c99/c11 hides it unless
+// every unit defines _POSIX_C_SOURCE.
+typedef sigjmp_buf SxJmpBuf;
+#define _sxSetJmp(buf)        sigsetjmp(buf, 0)
+#define _sxLongJmp(buf)       siglongjmp(buf, 1)
+#elif SX_JUMP_BACKEND == SX_JUMP_BUILTIN
+// Saves only the frame pointer, stack pointer and resume address; the
+// compiler spills everything else in functions using try.
+typedef void *SxJmpBuf[5];
+#define _sxSetJmp(buf)        __builtin_setjmp(buf)
+#define _sxLongJmp(buf)       __builtin_longjmp(buf, 1)
+#elif SX_JUMP_BACKEND == SX_JUMP_ASM
+// Saves callee-saved registers, stack pointer and return address. The signal
+// mask, FPU control words and shadow stacks are not touched. saneex.c must be
+// compiled with the default AT&T assembler syntax (not -masm=intel).
+#if defined(__x86_64__) && defined(__ELF__) && !defined(_WIN32)
+typedef void *SxJmpBuf[8];
+#elif defined(__aarch64__) && defined(__ELF__)
+typedef void *SxJmpBuf[22];
+#else
+#error SX_JUMP_ASM is only implemented for x86-64 SysV and aarch64 ELF.
+#endif
+int _sxAsmSetJmp(SxJmpBuf) __attribute__ ((returns_twice));
+void _sxAsmLongJmp(SxJmpBuf) __attribute__ ((noreturn));
+#define _sxSetJmp(buf)        _sxAsmSetJmp(buf)
+#define _sxLongJmp(buf)       _sxAsmLongJmp(buf)
+#else
+#error Unknown SX_JUMP_BACKEND.
+#endif
+
 // Exit codes used when saneex is terminating the process.
 // In all such cases a message is output to stderr.
 //
@@ -140,17 +534,23 @@ ______________________________________________________________________________
 // Trapping the exit signal and not terminating when one of the below conditions
 // (i.e. except EXIT_UNCAUGHT) has happened is a call for trouble because the
 // state of saneex is messed up.
-#define EXIT_MAX_TRIES        254   // too many nested try blocks.
+#define EXIT_MAX_TRIES        254   // no memory for more nested try blocks.
 #define EXIT_NO_TRY_ON_LEAVE  253   // endtry without a matching try.
 #define EXIT_OUTSIDE_RETHROW  252   // rethrow() used outside of catch/all.
 #define EXIT_OUTSIDE_CAUGHT   251   // catch/all/finally without a matching try.
 #define EXIT_TOO_NESTED       250   // potentially impossible.
+#define EXIT_NO_MEMORY        249   // no memory for an sxAttach() payload,
+                                    // an sxDefer() record or sxalloc().
+#define EXIT_STATE_IN_USE     248   // sxFreeState() of a current state or
+                                    // one with try blocks entered.
+#define EXIT_LAYOUT_MISMATCH  247   // a unit was built with different
+                                    // SX_MAX_... than saneex.c.
 
 #define newex() \
-  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, "\0", NULL})
+  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, "", NULL, 0, 0, 0, NULL})
 
 #define msgex(m) \
-  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, m, NULL})
+  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, m, NULL, 0, 0, 0, NULL})
 
 // Example (extra will be automatically freed when this entry is evicted):
 //   TimeoutException *e = malloc(sizeof(*e));
@@ -158,7 +558,7 @@ ______________________________________________________________________________
 //   e->limit = MAX_TIMEOUT;
 //   throw(exex("Connection timed out", e));
 #define exex(m, e) \
-  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, m, e})
+  ((struct SxTraceEntry) {errno, 0, __FILE__, __LINE__, m, e, 0, 0, 0, NULL})
 
 #define thri(x) \
   thrif(x, "")
@@ -166,23 +566,61 @@ ______________________________________________________________________________
 #define thrif(x, m) \
   if (x) sxThrow(msgex("Assertion error: " #x "; " m))
 
+#define thrres(r) \
+  _sxThrowIfError((r), __FILE__, __LINE__)
+
+#define sxok() \
+  ((struct SxResult) {0, NULL})
+
+#define sxerr(c, m) \
+  ((struct SxResult) {c, m})
+
 // Output on uncaught exception.
 //
 //   int main(int argc, char **argv) {
 //     sxTag = "For support visit http://proger.me";
 extern char *sxTag;
+// Must be set before the thread's first event (see the header comment).
+extern const char *sxRecorderPath;
+// For log shippers, e.g. a pipe or a socket; defaults to -1.
+extern int sxExportFd;
 // Used in the macros; do not use directly.
-extern SX_THREAD_LOCAL int _sxLastJumpCode;
-
-// '{{{' allows detecting a missing endtry on compile-time.
-#define try           {{{ if (_sxEnterTry2( setjmp(*_sxEnterTry()) ))
-#define catch(n)      else if (_sxLastJumpCode == (n) && _sxSetCaught(0))
-#define catchall      else if (_sxSetCaught(0))
-#define finally       if (_sxSetCaught(1))
-#define endtry        _sxLeaveTry(__FILE__, __LINE__); }}}
+#define _sxLastJumpCode (_sxGetState()->lastJumpCode)
+
+// '{{{' allows detecting a missing endtry on compile-time. _sxSite records
+// which handlers this particular try has (see struct SxTrySite).
+#define try           _sxTryIf(1)
+#define _sxTryIf(cond) \
+  {{{ _sxShadowing(static struct SxTrySite _sxSite;) \
+  if (_sxEnterTry2( _sxSetJmp(*_sxEnterTry(&_sxSite)) ) && (cond))
+#define catch(n)      else if (_sxMarkSite(_sxSite, hasCatch) && \
+                               _sxLastJumpCode == (n) && _sxSetCaught(0))
+#define catchall      else if (_sxMarkSite(_sxSite, hasCatch) && \
+                               _sxSetCaught(0))
+#define catchswitch   else switch (_sxMarkSite(_sxSite, hasCatch) \
+                                   ? _sxLastJumpCode : 0)
+#define catchcase(n)  break; case (n): if (_sxSetCaught(0))
+#define catchdefault  break; default: if (_sxSetCaught(0))
+#define finally       if (_sxMarkSite(_sxSite, hasFinally) && _sxSetCaught(1))
+#define endtry        _sxLeaveTry(&_sxSite, __FILE__, __LINE__); }}}
 #define curex         sxCurrentException
 #define throw         sxThrow
 #define rethrow       sxRethrow
+#define curexp        sxCurrentExceptionPtr
+#define throwp        sxThrowPtr
+#define rethrowp      sxRethrowPtr
+#define leave(code)   sxLeave(code)
+#define curextra(T)   ((T *) sxCurrentExtra(sizeof(T)))
+#define tryif(f, d)   _sxTryIf(_sxEnterFilter((f), (d)))
+#define deadline(ns)  _sxTryIf(_sxEnterDeadline((ns), 0))
+#define deadlinex(ns, catchable) \
+                      _sxTryIf(_sxEnterDeadline((ns), (catchable)))
+#define enddeadline   _sxEndDeadline(&_sxSite); endtry
+#define capture(r)    { struct SxResult *_sxResult = &(r); \
+                        *_sxResult = sxok(); try
+#define endcapture    else if (_sxMarkSite(_sxSite, hasCatch) && \
+                               _sxCaptureResult(_sxResult) && \
+                               _sxSetCaught(0)) {} endtry }
 
 struct SxTraceEntry {
   // Values below 1 are mapped to 1 (but shown verbatim in traces).
@@ -193,52 +631,620 @@ struct SxTraceEntry {
   // blocks are allowed to execute and finalize things.
   char  uncatchable;
 
-  // sxlcpy() can be used to safely copy a value from a char* to this char[]:
-  //   struct SxTraceEntry entry = newex();
-  //   sxlcpy(entry.message, msg);
-  //
-  // snprintf() is also safe for directly setting a formatted string:
-  //   snprintf(entry.file, SX_MAX_TRACE_STRING, "%s foo!", s);
+  // file and message are kept by pointer, never copied, so they must stay
+  // valid for as long as the trace is (__FILE__ and string literals do):
+  //   (struct SxTraceEntry) {.file = a ? "foo.c" : "bar.c", .message = "Oops"}
   //
-  // A constant string can be simply assigned in the initializer:
-  //   (struct SxTraceEntry) {.file = "foo.c"}
+  // A message built on run-time must be set with sxprintf() which formats it
+  // into saneex's own per-thread buffer (truncated to SX_MAX_TRACE_STRING):
+  //   struct SxTraceEntry entry = sxprintf(newex(), "%s", msg);
   //
-  // ...but not when an expression such as ?: is used (even if it's constant):
-  //   (struct SxTraceEntry) {.file = a ? "foo" : "bar"}    // compiler error
-  //   (struct SxTraceEntry) {.file = file}                 // compiler error
-  char  file[SX_MAX_TRACE_STRING];
+  // Only such text is copied (once) when the entry is added to the trace.
+  // Either pointer may be NULL. Read message with sxMessage() unless the entry
+  // came from sxWalkTrace() or curex/p() (see sxprintf()).
+  const char *file;
   int   line;
-  char  message[SX_MAX_TRACE_STRING];
+  const char *message;
 
-  // Not used by saneex in any way except automatically free()'ing if non-NULL.
+  // Not used by saneex in any way except automatically free()'ing if non-NULL
+  // (or recycling if set by sxAttach()).
   void  *extra;
+
+  // Set by saneex: number of try blocks without catch and finally that the
+  // exception went through after this entry (they don't add own entries).
+  int   passed;
+
+  // Set by sxAttach(): one of SX_EXTRA_... and the payload's size.
+  char  extraKind;
+  size_t extraSize;
+
+  // If set, called with extra when the entry is evicted, before extra is
+  // free()'d or recycled (e.g. a destructor of an object in the payload).
+  void  (*extraDel)(void *extra);
+};
+
+// Result of a function that reports errors without throwing. code is 0 on
+// success. message is kept by pointer like SxTraceEntry's; the one set by
+// capture() stays valid until the next throw.
+struct SxResult {
+  int   code;
+  const char *message;
+};
+
+// Values for SxTraceEntry.extraKind.
+#define SX_EXTRA_MALLOC       0   // free()'d; size is unknown (0).
+#define SX_EXTRA_INLINE       1   // in SxState.payloads, moved into the trace.
+#define SX_EXTRA_POOL         2   // SX_POOL_BLOCK from SxState.pool.
+
+// Storage for an inline payload, aligned for any scalar type.
+union SxPayload {
+  char bytes[SX_MAX_PAYLOAD];
+  long double ld;
+  long long ll;
+  void *p;
 };
 
+// Per-site totals of sxTelemetrySnapshot(). ns is the sum of times from
+// throw to the handling endtry (0 for throw sites). A site is a file name (not
+// its address, which may differ between units) and a line.
+struct SxSiteStats {
+  const char *file;
+  int   line;
+  unsigned long count;
+  unsigned long long ns;
+};
+
+struct SxTelemetry {
+  // Set by the caller: arrays to receive site totals (may be NULL if max is 0).
+  struct SxSiteStats *throwSites;
+  int   maxThrowSites;
+  struct SxSiteStats *catchSites;
+  int   maxCatchSites;
+
+  // Set by sxTelemetrySnapshot(). histogram[i] counts catches that took
+  // 2^i..2^(i+1)-1 ns (the last one - any longer). dropped counts sites not
+  // listed because a per-thread table or the caller's array was full.
+  int   numThrowSites;
+  int   numCatchSites;
+  unsigned long throws;
+  unsigned long catches;
+  unsigned long dropped;
+  unsigned long histogram[SX_HISTOGRAM];
+};
+
+// Payload of SX_FAULT (see sxCatchFaults()).
+struct SxFault {
+  int   signal;         // SIGSEGV, SIGBUS or SIGFPE.
+  int   code;           // siginfo_t's si_code, e.g. SEGV_MAPERR, FPE_INTDIV.
+  void  *address;       // si_addr: the faulting memory or instruction.
+};
+
+// Values for SxEvent.kind.
+#define SX_EVENT_ENTER        1   // try entered or jumped to; aux = caught.
+#define SX_EVENT_CATCH        2   // a catch/catchall entered; aux = caught.
+#define SX_EVENT_FINALLY      3   // a finally entered; aux = caught.
+#define SX_EVENT_LEAVE        4   // endtry; aux = caught, file and line.
+#define SX_EVENT_THROW        5   // a throw; aux = trace entries before it (0
+                                  // if new, else a rethrow), file, line, text.
+#define SX_EVENT_UNWIND       6   // jumping to a try; aux = tries passed.
+
+// One SX_VERBOSE/SX_RECORDER event (64 bytes). Strings are cut to fit: file
+// keeps its end, text (the message) its start.
+struct SxEvent {
+  char  kind;
+  int   depth;                  // number of entered tries.
+  int   code;
+  int   aux;
+  int   line;
+  char  file[20];
+  char  text[24];
+};
+
+// A ring of events; the last one is at (next - 1) % capacity. Fields have
+// fixed sizes for reading files of sxRecorderPath made by another build.
+struct SxRecorder {
+  char  magic[8];               // "SXREC1".
+  int   eventSize;              // sizeof(struct SxEvent).
+  int   capacity;
+  unsigned long long next;      // number of events ever written.
+  struct SxEvent events[];
+};
+
+// Everything below is internal to saneex.c. It's declared here only because
+// the catch() macro reads lastJumpCode of the state and for SX_INLINE.
+
+// One per try in the source code. hasCatch and hasFinally are set by the macros
+// when control reaches them; known is set by endtry of a try that an exception
+// was jumped to and that didn't handle it (so the handlers were all reached
+// and both are final by then). A throw doesn't stop at known tries having
+// neither - their endtry would only rethrow.
+struct SxTrySite {
+  char hasCatch;
+  char hasFinally;
+  char known;
+};
+
+// Sets a flag of a site. Other threads may be unwinding through the same try
+// so this is an atomic store (ordered before known by setKnown()). It's only
+// done if the flag is unset so that finally doesn't write the shared line on
+// every run.
+#ifdef __GNUC__
+#define _sxMarkSite(site, flag) \
+  (__atomic_load_n(&(site).flag, __ATOMIC_RELAXED) || \
+   (__atomic_store_n(&(site).flag, 1, __ATOMIC_RELAXED), 1))
+#else
+#define _sxMarkSite(site, flag) ((site).flag || ((site).flag = 1))
+#endif
+
+// A nested try declares its own _sxSite hiding the outer one on purpose.
+#ifdef __GNUC__
+#define _sxShadowing(decl) \
+  _Pragma("GCC diagnostic push") \
+  _Pragma("GCC diagnostic ignored \"-Wshadow\"") \
+  decl \
+  _Pragma("GCC diagnostic pop")
+#else
+#define _sxShadowing(decl) decl
+#endif
+
+struct SxTryContext {
+  // SxJmpBuf's type is an array.
+  SxJmpBuf buf;
+  int caught;
+  // Set by unwind() before it jumps here.
+  char jumped;
+  struct SxTrySite *site;
+  // SxState.nextDefer and regionTop when this try was entered.
+  int deferMark;
+  char *regionMark;
+#ifdef SX_TELEMETRY
+  // SxState.throwTime of the exception that jumped here, or 0.
+  long long thrown;
+#endif
+};
+
+struct SxDeferRecord {
+  void (*func)(void *);
+  void *ptr;
+};
+
+// Returns non-zero if the try wants to handle the exception (then its
+// catch blocks are run as usual). code is as catch() sees it, entry is the
+// current exception (curexp(), NULL if the trace is empty) with a deferred
+// message already formatted.
+typedef char SxFilter(int code, const struct SxTraceEntry *entry, void *data);
+
+// An entered tryif().
+struct SxTryFilter {
+  SxFilter *func;
+  void *data;
+  // nextContext of the try.
+  int context;
+};
+
+// An entered deadline scope. at is in the clock of sxCheckDeadline() (ns)
+// and is never later than that of the enclosing scope.
+struct SxDeadline {
+  long long at;
+  // nextContext of the scope's try.
+  int context;
+  // Set by deadlinex(); the timeout is thrown catchable.
+  char catchable;
+};
+
+// One block of the sxalloc() region; data follows the (aligned) header.
+struct SxRegionChunk {
+  struct SxRegionChunk *prev;
+  struct SxRegionChunk *next;
+  char *end;
+};
+
+// Contexts are kept in a list of segments. The first try allocates a small
+// one (SX_FIRST_SEGMENT); deeper levels malloc() more SX_TRY_SEGMENT-sized
+// segments which are kept (not freed) once unwound for reuse by the next
+// deep try.
+struct SxTrySegment {
+  struct SxTrySegment *prev;
+  struct SxTrySegment *next;
+  int size;
+  struct SxTryContext contexts[];
+};
+
+// All per-thread state is in one struct so that each function computes the
+// (thread-local) address only once. It's allocated zeroed on first use, so a
+// thread that never uses saneex only has two pointers of thread-local data.
+// Besides the thread's own there may be any number of states made by
+// sxNewState().
+struct SxState {
+  // Only meaningful for the topmost context.
+  int lastJumpCode;
+  // Total number of nested contexts (in all segments).
+  int nextContext;
+  // Segment holding the topmost context (NULL until the first try), its
+  // first unused context and end. nextFree is segmentEnd initially so that
+  // the first try goes through _sxNextSegment().
+  struct SxTrySegment *segment;
+  struct SxTryContext *nextFree;
+  struct SxTryContext *segmentEnd;
+  char hasUncatchable;
+  // Set while a leave() is unwinding; endtry adds no trace entries then.
+  char leaving;
+  // Set once the exception being unwound was reported as uncaught.
+  char reported;
+  // nextContext of the try that unwind() has jumped to only to run its
+  // finally (its filter declined the exception), or 0.
+  int declinedContext;
+  int nextTrace;
+  int nextScratch;
+  struct SxTraceEntry trace[SX_MAX_TRACE];
+  // Storage for messages formatted by sxprintf(): texts[i] belongs to
+  // trace[i], the last SX_MAX_SCRATCH rows are cycled by sxprintf() itself.
+  // Static strings never end up here. If deferred[i] is set then texts[i] is
+  // "" followed by the format string and arguments, not yet formatted.
+  char texts[SX_MAX_TRACE + SX_MAX_SCRATCH][SX_MAX_TRACE_STRING];
+  char deferred[SX_MAX_TRACE + SX_MAX_SCRATCH];
+  // Inline sxAttach() payloads, laid out like texts (with own scratch rows).
+  int nextPayload;
+  union SxPayload payloads[SX_MAX_TRACE + SX_MAX_SCRATCH];
+  // Unused SX_POOL_BLOCK-sized blocks, linked through their first pointer.
+  void *pool;
+  // sxDefer() records; realloc()'ed as needed.
+  struct SxDeferRecord *defers;
+  int nextDefer;
+  int maxDefers;
+  // Free space of the sxalloc() region in regionChunk. All three are NULL
+  // if nothing is allocated; regionFirst is the list's head kept for reuse.
+  char *regionTop;
+  char *regionEnd;
+  struct SxRegionChunk *regionChunk;
+  struct SxRegionChunk *regionFirst;
+  // Entered tryif() filters; realloc()'ed as needed.
+  struct SxTryFilter *filters;
+  int nextFilter;
+  int maxFilters;
+  // Entered deadline scopes; likewise.
+  struct SxDeadline *deadlines;
+  int nextDeadline;
+  int maxDeadlines;
+  // SxDeadline.context of the scope that the SX_TIMEOUT being unwound
+  // belongs to, or 0.
+  int timeoutContext;
+#if SX_BACKTRACE
+  // Return addresses of the current exception's throw() and its callers.
+  void *backtrace[SX_BACKTRACE];
+  int backtraceSize;
+#endif
+#ifdef SX_TELEMETRY
+  // When the exception being unwound was thrown (CLOCK_MONOTONIC ns), 0 if
+  // it's a leave().
+  long long throwTime;
+#endif
+};
+
+// The thread's own state and the current one (both NULL until first used,
+// then the same unless sxSwitchState() was called).
+extern SX_THREAD_LOCAL struct SxState *_sxThreadState SX_TLS_MODEL;
+extern SX_THREAD_LOCAL struct SxState *_sxState SX_TLS_MODEL;
+
+// Exits with EXIT_LAYOUT_MISMATCH if stateSize (sizeof(struct SxState) as
+// seen by the unit file) differs from saneex.c's.
+void _sxCheckLayout(size_t stateSize, const char *file);
+
+#ifdef __GNUC__
+// Every unit including saneex.h checks its layout once, before main().
+__attribute__ ((constructor)) static void _sxCheckUnitLayout(void) {
+  _sxCheckLayout(sizeof(struct SxState), __BASE_FILE__);
+}
+#endif
+
+// Returns a new zeroed state (never NULL) to be passed to sxSwitchState().
+struct SxState *sxNewState(void);
+// Makes st (or the thread's own state if NULL) current for this thread and
+// returns the previously current one. Call between try blocks of the code
+// being suspended, e.g. when switching fibers.
+struct SxState *sxSwitchState(struct SxState *st);
+// Frees st with its trace, segments, sxalloc() chunks, etc. st must not be
+// current in any thread and must have no try blocks entered.
+void sxFreeState(struct SxState *st);
+
 // Returns the number of trace entries (= the number of times func was called).
 int sxWalkTrace(void func(const struct SxTraceEntry *, void *), void *data);
 void sxPrintTrace();
+// Returns return addresses (the innermost first) captured when the current
+// exception was thrown, or NULL if there are none (*size is set to 0).
+// Valid until the next throw. Always NULL unless SX_BACKTRACE is set.
+void *const *sxCurrentBacktrace(int *size);
+// Writes this thread's current trace to fd as a single line of JSON with one
+// write() (more if it was interrupted) of up to 4 KiB:
+//   {"tag":"...","trace":[{"code":1,"uncatchable":false,"file":"a.c",
+//    "line":12,"message":"...","passed":1},...],"backtrace":["0x..."]}
+// passed is omitted if 0. A deferred sxprintf() message is given as "format"
+// and "args" since formatting it is not async-signal-safe. Entries that don't
+// fit are dropped and "truncated":true is added. Uses no stdio or malloc() so
+// it can be called from a signal handler. Returns 0 or -1 on error (errno).
+int sxExportTrace(int fd);
 void sxPrintEntryToStdErr(const struct SxTraceEntry *, void *);
 // Returns current top-level trace entry or an entry with code = -1 if not
 // executing inside a catch or finally (other fields are underfined).
+// An sxprintf()'d message stays valid until the next throw.
 struct SxTraceEntry sxCurrentException(void);
+// Like sxCurrentException() but returns a pointer into the trace (valid until
+// the next throw), or NULL in place of code = -1.
+const struct SxTraceEntry *sxCurrentExceptionPtr(void);
 // Appends a new entry to the current trace as if an exception was thrown; no
 // need to call manually. Does nothing if neither file, message or extra is set.
 void sxAddTraceEntry(const struct SxTraceEntry);
+void sxAddTraceEntryPtr(const struct SxTraceEntry *);
+
+// Run-time state consistency check (used by SX_INLINE functions too).
+#if defined(SX_ASSERT) && !defined(NDEBUG)
+#define _sxAssert(x, c) \
+  assert(x)
+#else
+#define _sxAssert(x, c) \
+  if (!(x)) _sxAssertFailed(#x, __FILE__, __LINE__, c)
+#endif
+
+// An arbitrary high value to bypass subsequent catch/catchall/finally.
+#define SX_FINALLY_THRESHOLD  50
+
+// Cold paths of the functions below, always in saneex.c.
+void _sxAssertFailed(const char *expr, const char *file, int line, int code);
+struct SxState *_sxInitState(void);
+void _sxNextSegment(struct SxState *);
+SX_NORETURN void _sxLeaveTryThrow(struct SxTrySite *, char jumped,
+  const char *file, int line);
+void _sxGrowDefers(struct SxState *);
+void _sxRunDefers(struct SxState *, int depth);
+void *_sxGrowRegion(struct SxState *, size_t size);
+void _sxResetRegion(struct SxState *, char *mark);
+char _sxEnterFilter(SxFilter *func, void *data);
+char _sxEnterDeadline(long long ns, char catchable);
+void _sxCheckClock(struct SxState *, const char *file, int line);
+void _sxCatchTimeout(struct SxState *);
+void _sxCountCatch(long long thrown, const char *file, int line);
+#if defined(SX_VERBOSE) || defined(SX_RECORDER)
+void _sxRecord(char kind, int depth, int code, int aux, const char *file,
+  int line, const char *text);
+#define _sxEvent(kind, st, code, aux, file, line, text) \
+  _sxRecord(kind, (st)->nextContext, code, aux, file, line, text)
+#else
+#define _sxEvent(kind, st, code, aux, file, line, text)
+#endif
+
+// Returns this thread's current state. The empty asm hides the address'
+// origin so that gcc keeps it in a register instead of repeating the
+// __tls_get_addr() call (in -fPIC code) at every access.
+static inline struct SxState *_sxGetState(void) {
+  struct SxState *st = _sxState;
+
+  if (!st) {
+    st = _sxInitState();
+  }
+
+#ifdef __GNUC__
+  __asm__ ("" : "+r" (st));
+#endif
+  return st;
+}
+
+// Only valid if st->nextContext > 0.
+static inline struct SxTryContext *_sxTopContext(struct SxState *st) {
+  return st->nextFree - 1;
+}
+
+// Unwound segments are kept for reuse. The topmost context is always in
+// st->segment (so the first segment may stay empty).
+static inline void _sxPopContext(struct SxState *st) {
+  st->nextContext--;
+
+  if (--st->nextFree == st->segment->contexts && st->segment->prev) {
+    st->segment = st->segment->prev;
+    st->nextFree = st->segmentEnd = st->segment->contexts + st->segment->size;
+  }
+}
 
 // Used by the try..catch macros. Should not be called directly.
-jmp_buf *_sxEnterTry(void);
-char _sxEnterTry2(int code);
-void _sxLeaveTry(const char *file, int line);
+//
+// They're defined right here so that SX_INLINE can make them static inline;
+// otherwise only saneex.c (that defines _SX_DEFINE_FAST) compiles them as
+// regular external functions.
+#if defined(SX_INLINE) && !defined(_SX_DEFINE_FAST)
+#define _SX_FAST static inline
+#else
+#define _SX_FAST
+SxJmpBuf *_sxEnterTry(struct SxTrySite *);
+char _sxEnterTry2(int jumped);
+void _sxLeaveTry(struct SxTrySite *, const char *file, int line);
 char _sxSetCaught(char isFinally);
+void sxDefer(void func(void *), void *ptr);
+void *sxalloc(size_t size);
+#endif
+
+#if defined(SX_INLINE) || defined(_SX_DEFINE_FAST)
+// A "try" is split into two calls to _sxEnterTry/2() because:
+//   "If the function which called setjmp() returns before longjmp() is called,
+//    the behavior is undefined."
+// try cannot be just a call to _sxEnterTry() with setjmp() inside it so
+// as long as each try is paired with an endtry - it will work
+// (there's no way to leave a function bypassing endtry when using re/throw).
+_SX_FAST SxJmpBuf *_sxEnterTry(struct SxTrySite *site) {
+  struct SxState *st = _sxGetState();
+
+  if (st->nextFree == st->segmentEnd) {
+    _sxNextSegment(st);
+  }
+
+  struct SxTryContext *cx = st->nextFree++;
+  st->nextContext++;
+  cx->caught = 0;
+  cx->jumped = 0;
+  cx->site = site;
+  cx->deferMark = st->nextDefer;
+  cx->regionMark = st->regionTop;
+#ifdef SX_TELEMETRY
+  cx->thrown = 0;
+#endif
+  return &cx->buf;
+}
+
+// Returns 0 if entering a try block, non-0 if entering a catch block (i.e.
+// a throw was called). When jumped, _throw() has already set _sxLastJumpCode.
+_SX_FAST char _sxEnterTry2(int jumped) {
+  struct SxState *st = _sxGetState();
+
+  if (!jumped) {
+    st->lastJumpCode = 0;
+  }
+
+  _sxEvent(SX_EVENT_ENTER, st, st->lastJumpCode, _sxTopContext(st)->caught,
+    NULL, 0, NULL);
+
+  // Used to catch bugs due to an infinite throw/try/throw/... loop.
+  _sxAssert(_sxTopContext(st)->caught < 1000, EXIT_TOO_NESTED);
+  return !jumped;
+}
+
+_SX_FAST void _sxLeaveTry(struct SxTrySite *site, const char *file,
+    int line) {
+  struct SxState *st = _sxGetState();
+  _sxAssert(st->nextContext > 0, EXIT_NO_TRY_ON_LEAVE);
+
+  _sxEvent(SX_EVENT_LEAVE, st, st->lastJumpCode, _sxTopContext(st)->caught,
+    file, line, NULL);
+
+  struct SxTryContext *top = _sxTopContext(st);
+  const int deferMark = top->deferMark;
+  const char jumped = top->jumped;
+  char *const regionMark = top->regionMark;
+#ifdef SX_TELEMETRY
+  const long long thrown = top->thrown;
+#endif
+  _sxPopContext(st);
+
+  if (st->nextDefer > deferMark) {
+    _sxRunDefers(st, deferMark);
+  }
+
+  if (st->regionTop != regionMark) {
+    _sxResetRegion(st, regionMark);
+  }
+
+#ifdef SX_TELEMETRY
+  // An exception jumped here and didn't go further.
+  if (thrown && !st->hasUncatchable && !st->lastJumpCode) {
+    _sxCountCatch(thrown, file, line);
+  }
+#endif
+
+  // See _sxLeaveTryThrow() for when this happens.
+  if (st->hasUncatchable || st->lastJumpCode) {
+    _sxLeaveTryThrow(site, jumped, file, line);
+  }
+}
+
+_SX_FAST char _sxSetCaught(char isFinally) {
+  struct SxState *st = _sxGetState();
+  _sxAssert(st->nextContext > 0, EXIT_OUTSIDE_CAUGHT);
+
+  struct SxTryContext *cx = _sxTopContext(st);
+  const int caught = ++cx->caught;
+
+  if (!isFinally) {   // a catch.
+    if (caught == 1) {
+      _sxEvent(SX_EVENT_CATCH, st, st->lastJumpCode, caught, NULL, 0, NULL);
+      st->lastJumpCode = 0;
+      return 1;
+    }
+  } else {          // a finally.
+    if (caught < SX_FINALLY_THRESHOLD) {
+      _sxEvent(SX_EVENT_FINALLY, st, st->lastJumpCode, caught, NULL, 0, NULL);
+      return cx->caught = SX_FINALLY_THRESHOLD;
+    }
+  }
+
+  return 0;
+}
+
+// Calls func(ptr) when leaving the innermost try (both normally and on an
+// exception) unless removed by sxUndefer() earlier. Calls are in reverse
+// order of sxDefer()'s.
+_SX_FAST void sxDefer(void func(void *), void *ptr) {
+  struct SxState *st = _sxGetState();
+
+  if (st->nextDefer == st->maxDefers) {
+    _sxGrowDefers(st);
+  }
+
+  struct SxDeferRecord *rec = &st->defers[st->nextDefer++];
+  rec->func = func;
+  rec->ptr = ptr;
+}
+
+// Returns size bytes (aligned to 16) valid until endtry of the innermost try
+// (or forever if not inside a try). Never returns NULL; 0 bytes are taken as
+// 16 so that each call returns a distinct pointer.
+_SX_FAST void *sxalloc(size_t size) {
+  struct SxState *st = _sxGetState();
+  const size_t rounded = (size + 15 + !size) & ~(size_t) 15;
+
+  // rounded < size if it has wrapped around (_sxGrowRegion() fails then).
+  if (rounded < size || (size_t) (st->regionEnd - st->regionTop) < rounded) {
+    return _sxGrowRegion(st, size);
+  }
+
+  void *ptr = st->regionTop;
+  st->regionTop += rounded;
+  return ptr;
+}
+#endif
 
-// Useful for setting SxTraceEntry's file[] or message[].
 // Calls sxlcpyn() with n = SX_MAX_TRACE_STRING.
 char *sxlcpy(char *dest, const char *src);
 // Unlike strncpy() ensures dest ends on '\0'.
 char *sxlcpyn(char *dest, const char *src, int n);
+// The text lives in one of a few per-thread scratch buffers until the entry
+// is thrown (or added to the trace) so don't hold on to the returned entry
+// over other sxprintf() calls:
 //   throw(sxprintf(newex(), "errno = %d", errno));
+//
+// Most exceptions are caught without their message ever being read, so with
+// SX_DEFER_ARGS set, if fmt has only numeric and %p conversions (up to that
+// many) then only fmt and the values are stored and formatting happens on
+// first sxMessage(), sxWalkTrace() or curex/p(); until then message is "".
+// Like message, fmt is then kept by pointer so in such builds it must be a
+// literal or otherwise outlive the trace. Other conversions (%s, %n, '*'
+// width, long double) are formatted at once.
 struct SxTraceEntry sxprintf(struct SxTraceEntry entry, const char *fmt, ...);
+// Formats entry->message in place and returns entry:
+//   struct SxTraceEntry e = newex();
+//   throwp(sxprintfp(&e, "errno = %d", errno));
+struct SxTraceEntry *sxprintfp(struct SxTraceEntry *entry, const char *fmt, ...);
+// Returns entry->message, formatting a deferred sxprintf() if necessary.
+// Never returns NULL.
+const char *sxMessage(const struct SxTraceEntry *entry);
+// Returns uninitialized memory for a payload of size bytes and sets it as
+// entry->extra. It's recycled (not free()'d) when the entry is evicted and
+// needs no malloc() unless larger than SX_POOL_BLOCK:
+//   struct SxTraceEntry e = msgex("Connection timed out");
+//   struct Timeout *t = sxAttach(&e, sizeof(*t));
+//   t->elapsed = timeElapsed;
+//   throw(e);
+// Like with sxprintf(), an inline payload is in a scratch buffer until the
+// entry is thrown, and entry->extra changes when it is. A rethrown entry of the
+// trace (e.g. rethrow(curex())) shares the payload with the original.
+void *sxAttach(struct SxTraceEntry *entry, size_t size);
+// Releases entry's payload (calling extraDel) and clears extra, for an entry
+// that won't be thrown after all. Does nothing to a payload of the trace.
+void sxDetach(struct SxTraceEntry *entry);
+// Returns extra of the current exception or NULL if there's none or if it
+// was sxAttach()'ed with less than size bytes. Use curextra() instead:
+//     ...
+//   } catch(timeout) {
+//     printf("%d", curextra(struct Timeout)->elapsed);
+void *sxCurrentExtra(size_t size);
 SX_NORETURN void sxThrow(const struct SxTraceEntry);
+SX_NORETURN void sxThrowPtr(const struct SxTraceEntry *);
 // If code is < 1 then it's set to _sxLastJumpCode.
 // If you don't want to add any info to the current exception - rethrow newex():
 //     ...
@@ -248,3 +1254,71 @@ SX_NORETURN void sxThrow(const struct SxTraceEntry);
 //     rethrow(newex());
 //   }
 SX_NORETURN void sxRethrow(const struct SxTraceEntry);
+SX_NORETURN void sxRethrowPtr(const struct SxTraceEntry *);
+// Unwinds to the nearest try like throw() (running catch and finally blocks
+// on the way) but the trace is only cleared, not added to, so curex().code
+// is -1 in the catch. Meant for control flow, e.g. leaving a deep recursion:
+//   try {
+//     parse(input);
+//   } catch(parseDone) {
+//   } endtry
+SX_NORETURN void sxLeave(int code);
+// Throws an exception with r's code and message and the given file/line.
+// Used by thrres() which does nothing if r.code is 0.
+SX_NORETURN void sxThrowResult(struct SxResult r, const char *file, int line);
+
+static inline void _sxThrowIfError(struct SxResult r, const char *file,
+    int line) {
+  if (r.code) { sxThrowResult(r, file, line); }
+}
+
+// Throws an SX_TIMEOUT (with this file/line; uncatchable unless the scope is
+// deadlinex(ns, 1)) if the innermost deadline scope's time has passed. Does
+// nothing outside of such scopes.
+#define sxCheckDeadline() \
+  _sxCheckDeadline(__FILE__, __LINE__)
+
+static inline void _sxCheckDeadline(const char *file, int line) {
+  struct SxState *st = _sxGetState();
+  if (st->nextDeadline) { _sxCheckClock(st, file, line); }
+}
+
+// Used by enddeadline: stops the timeout if it belongs to this scope, which
+// makes the scope's try one with a catch.
+static inline void _sxEndDeadline(struct SxTrySite *site) {
+  struct SxState *st = _sxGetState();
+  (void) _sxMarkSite(*site, hasCatch);
+  if (st->timeoutContext == st->nextContext) { _sxCatchTimeout(st); }
+}
+
+int sxDeferDepth(void);
+// Removes sxDefer() records until depth of them remain, calling them if run.
+void sxUndefer(int depth, char run);
+
+#ifdef SX_TELEMETRY
+// Fills t with totals of all threads (including exited ones) since start.
+// Only reads memory (no locks or allocations) so can be called from a signal
+// handler; counts of other threads may lag a little.
+void sxTelemetrySnapshot(struct SxTelemetry *t);
+#endif
+
+#ifdef SX_FAULTS
+// Installs the handler of SIGSEGV, SIGBUS and SIGFPE that throws SX_FAULT
+// with struct SxFault attached. Handlers set before are called for signals
+// not thrown. Calls after the first do nothing. Returns 0 or -1 on error
+// (errno).
+int sxCatchFaults(void);
+#endif
+
+// Formats ev as SX_VERBOSE outputs it (without "\n"). Returns snprintf()'s
+// result.
+int sxFormatEvent(const struct SxEvent *ev, char *buf, size_t size);
+// Outputs events of rec to f, the oldest first. Returns their number or -1
+// if rec isn't a valid ring (e.g. a file from a different version).
+int sxPrintRecorder(const struct SxRecorder *rec, FILE *f);
+// Returns this thread's ring (created on the first event) or NULL if there's
+// none yet or SX_RECORDER isn't defined for saneex.c.
+struct SxRecorder *sxThreadRecorder(void);
+
+// Used by endcapture; sets *r from the exception being caught, returns 1.
+char _sxCaptureResult(struct SxResult *r);
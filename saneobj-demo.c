@@ -187,6 +187,66 @@ YesNo_vt *vtYesNo(void) {
   return &vt;
 }
 
+/*** IOError, ReadError - Exception Classes **********************************/
+
+struct IOError;
+
+typedef struct {
+  Exception_vt_;
+} IOError_vt_;
+
+typedef struct {
+  Exception_;
+  int fd;
+} IOError_;
+
+classdef(IOError, Exception);
+
+int ioErrorsDeleted;
+
+IOError *IOError_new(IOError *o, void *params) {
+  initnew(IOError);
+  o->fd = -1;
+  return o;
+}
+
+// (*) A destructor of an exception is called when the trace is cleared.
+void IOError_del(IOError *o) {
+  ioErrorsDeleted++;
+  inhdel(IOError)(o);
+}
+
+vtdef(IOError, Exception) {
+  vt.del = (dtor_t *) IOError_del;
+} endvtdef
+
+struct ReadError;
+
+typedef struct {
+  IOError_vt_;
+} ReadError_vt_;
+
+typedef struct {
+  IOError_;
+} ReadError_;
+
+classdef(ReadError, IOError);
+
+ReadError *ReadError_new(ReadError *o, void *params) {
+  initnew(ReadError);
+  return o;
+}
+
+vtdef(ReadError, IOError) {
+} endvtdef
+
+void readFile(int fd) {
+  // (*) Throwing an object; it's constructed right in the trace entry.
+  struct SxTraceEntry e = exobj(ReadError, "Cannot read");
+  ((ReadError *) e.extra)->fd = fd;
+  throw(e);
+}
+
 /*** Entry Point *************************************************************/
 
 int main () {
@@ -416,6 +476,47 @@ int main () {
       os->vt->caloriesPerQuantity(asp(os, Fruit), 2));
   } endsobj(os)
 
+  // (*) Catching by class: ReadError is an IOError.
+  try {
+    readFile(3);
+    printf("not good, it worked! Report this bug please!\n");
+    abort();
+  // Shouldn't compile - "<Orange> has no member named <Exception_>":
+  //} catchclass(Orange) {
+  } catchclass(IOError) {
+    printf("Caught %s (%s) for fd %d, %s a ReadError.\n",
+      //> ReadError, Cannot read
+      curobj(IOError)->vt->className, curex().message,
+      //> 3
+      curobj(IOError)->fd,
+      //> it's
+      curobj(ReadError) ? "it's" : "it's not (?!)");
+  } endtry
+
+  // (*) A rethrown exception shares the object with the original one.
+  try {
+    try {
+      readFile(4);
+    } catchclass(ReadError) {
+      rethrow(curex());
+    } endtry
+  } catchclass(IOError) {
+    printf("Rethrown %s for fd %d.\n",
+      //> ReadError, 4
+      curobj(IOError)->vt->className, curobj(IOError)->fd);
+  } endtry
+
+  try {
+    throw(msgex("Not an object"));
+  } catchclass(Exception) {
+    printf("not good, caught a non-object! Report this bug please!\n");
+    abort();
+  } catchall {
+    printf("Destructors of exceptions called: %d.\n",
+      //> 2 (one per ReadError, not per its rethrow, when the next was thrown)
+      ioErrorsDeleted);
+  } endtry
+
 #ifdef SJ_TRACE_LIFE
   printf(
     "The library tells us we have created %d objects and deleted %d of"
@@ -60,6 +60,44 @@ int Autoref_release(Autoref *o) {
   return atomic_fetch_sub(&o->refs, 1);
 }
 
+/*** Exception's methods *****************************************************/
+
+Exception_vt *vtException(void) {
+  linkvt(Exception, Object) {
+  }
+
+  return &vt;
+}
+
+Exception *Exception_new(Exception *o, void *params) {
+  initnew(Exception);
+  return o;
+}
+
+// Concurrent calls write the same values so it's enough that linked is
+// stored last.
+void sjLinkException(Exception_vt *vt) {
+  const int depth = sjCountParents(vt);
+
+  if (depth >= SJ_EXCEPTION_DEPTH) {
+    sxThrow(sxprintf(newex(),
+      "%s has more than SJ_EXCEPTION_DEPTH parents.",
+      vt->className));
+  }
+
+  for (int i = 0; i <= depth; i++) {
+    vt->ancestors[i] = sjNthParent(vt, i);
+  }
+
+  vt->depth = depth;
+  __atomic_store_n(&vt->linked, vt, __ATOMIC_RELEASE);
+}
+
+void sjDelException(void *obj) {
+  Object *o = (Object *) obj;
+  o->vt->del(o);
+}
+
 /*** Other Functions *********************************************************/
 
 #ifdef SJ_OBJECT_MAGIC
@@ -87,9 +125,7 @@ _Atomic unsigned sjObjectsCreated;
 _Atomic unsigned sjObjectsDeleted;
 
 static struct SxTraceEntry makeEx(const char *file, int line) {
-  struct SxTraceEntry entry = {.line = line};
-  sxlcpy(entry.file, file);
-  return entry;
+  return (struct SxTraceEntry) {.file = file, .line = line};
 }
 
 void *sjNew(ctor_t *ctor, void *params, size_t size,
@@ -146,11 +182,56 @@ void *sjNew(ctor_t *ctor, void *params, size_t size,
   return o;
 }
 
+struct SxTraceEntry sjException(struct SxTraceEntry entry, ctor_t *ctor,
+    void *vt, size_t size, void *params) {
+  // Before constructing so a too deep class doesn't leave an object behind.
+  sjExceptionClass(vt);
+
+  Object *const o = sxAttach(&entry, size);
+  Object *volatile made = NULL;
+  memset(o, 0, size);
+
+  try {
+    made = ctor(o, params);
+  } catchall {
+    sxDetach(&entry);
+
+    sxRethrow(sxprintf(makeEx(entry.file, entry.line),
+      "ctor(%p) error.",
+      ctor));
+  } endtry
+
+  if (made != o || !sjHasClass(o, vtException())) {
+    // Not calling del() of an object that wasn't constructed.
+    sxDetach(&entry);
+
+    sxThrow(sxprintf(makeEx(entry.file, entry.line),
+      "ctor(%p) didn't make an Exception in place.",
+      ctor));
+  }
+
+  entry.code = SJ_EXCEPTION;
+  entry.extraDel = sjDelException;
+  return entry;
+}
+
 char sjRelease(void *obj) {
   Autoref *ar = (Autoref *) obj;
   return !sjHasClass(obj, vtAutoref()) || ar->vt->release(ar) == 1;
 }
 
+void sjDelStack(void *obj) {
+  Object *o = (Object *) obj;
+
+  if (!sjRelease(o)) {
+    sxThrow(sxprintf(newex(),
+      "A %s object created on stack cannot be released (holding Autoref?).",
+      o->vt->className));
+  }
+
+  o->vt->del(o);
+}
+
 char sjDel(void *obj, const char* file, int line) {
   if (!sjRelease(obj)) {
     return 0;
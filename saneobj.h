@@ -45,6 +45,12 @@ ______________________________________________________________________________
 
     sjNthParent(vt, n)
       Get a VT of a specific parent by its index (a VT "from the end")
+
+    sjIsException(obj, vt)
+      Like sjHasClass() but for Exception subclasses and in constant time
+
+    sjCurrentObject()
+      Get the Exception object thrown with the current exception (or NULL)
 ______________________________________________________________________________
 
   Macros (C = class name, P = parent's class name):
@@ -85,7 +91,23 @@ ______________________________________________________________________________
     newsobj(C, var)           - "NEW S(tack|tatic) OBJect"
     newsobjx(C, var, params)  - "... eXtra"
     endsobj(var)
-      Help instantiating on-stack objects; note: for them var is *C
+      Help instantiating on-stack objects; note: for them var is *C. The
+      destructor is an sxDefer() record: it runs at endsobj or when an
+      exception unwinds to an enclosing try - with none (an uncaught
+      exception) it doesn't run before exit. Don't 'return' or 'goto' out of
+      the block: the record would stay and be run later by the enclosing try
+      on the object in a dead stack frame
+
+    exobj(C, message)
+    exobjx(C, message, params)
+      Make a saneex trace entry (for throw()) with code SJ_EXCEPTION and an
+      object of C (an Exception subclass) constructed in its payload
+
+    catchclass(C)
+      A catch matching exceptions thrown with exobj() of C or its subclasses
+
+    curobj(C)
+      The object of the exception being caught as C, NULL if incompatible
 ______________________________________________________________________________
 
   Overridable #defines:
@@ -103,6 +125,13 @@ ______________________________________________________________________________
     SJ_OBJECT_MAGIC
       If defined, each object's memory starts with 4 bytes of this value
 
+    SJ_EXCEPTION
+      saneex exception code of exobj() entries (default 0x534A)
+
+    SJ_EXCEPTION_DEPTH
+      Maximum number of classes from Object to an Exception subclass
+      (inclusive, default 16)
+
   Introduced when compiled with SJ_TRACE_LIFE #define:
 
     sjCreating
@@ -466,6 +495,14 @@ CLASS_vt *vtCLASS(void) {
 #define sjFree(obj)           free(obj)
 #endif
 
+#ifndef SJ_EXCEPTION
+#define SJ_EXCEPTION          0x534A
+#endif
+
+#ifndef SJ_EXCEPTION_DEPTH
+#define SJ_EXCEPTION_DEPTH    16
+#endif
+
 #define C_vt_(class)          class ## _vt_
 #define C_vt(class)           class ## _vt
 #define C_(class)             class ## _
@@ -590,6 +627,120 @@ int Autoref_take(Autoref *o);
 // another thread may be doing it.
 int Autoref_release(Autoref *o);
 
+/*** Exception - Root Of Exception Classes **********************************/
+
+// Exceptions carrying objects are caught by class rather than by code:
+//
+//   classdef(IOError, Exception);     // with an int fd property.
+//   classdef(ReadError, IOError);
+//   ...
+//   struct SxTraceEntry e = exobj(ReadError, "Cannot read");
+//   ((ReadError *) e.extra)->fd = fd;
+//   throw(e);
+//   ...
+//   } catchclass(IOError) {         // also catches ReadError.
+//     printf("%d", curobj(IOError)->fd);
+//   } endtry
+//
+// The object is constructed in the entry's sxAttach() payload (no
+// sjAlloc() unless it's larger than SX_POOL_BLOCK) and its del() is called
+// when the trace is cleared (by the next throw). Constructors and destructors
+// of Exception classes must not throw.
+//
+// Until thrown, a small object is in one of SX_MAX_SCRATCH rotating scratch
+// rows that other sxAttach() calls reuse, and throw() moves it into the trace
+// with memcpy(). So pass an exobj() entry straight to throw() (setting
+// properties in between is fine) and don't keep pointers to the object, into
+// it or from it to itself - it must be relocatable. An entry that won't be
+// thrown after all must be given to sxDetach() to release the object.
+
+struct Exception;
+
+typedef struct {
+  Object_vt_;
+  // Filled on first use (see sjExceptionClass()): ancestors[i] is the i-th
+  // class from Object, ancestors[depth] is this one. linked is this VT once
+  // they're filled (a subclass' VT starts as a copy of its parent's).
+  const void  *linked;
+  int         depth;
+  const void  *ancestors[SJ_EXCEPTION_DEPTH];
+} Exception_vt_;
+
+typedef struct {
+  Object_;
+} Exception_;
+
+classdef(Exception, Object);
+
+Exception_vt *vtException(void);
+Exception *Exception_new(Exception *o, void *params);
+
+// Fills vt's ancestors. Throws if vt is too deep (SJ_EXCEPTION_DEPTH).
+void sjLinkException(Exception_vt *vt);
+
+// Returns vt (an Exception subclass' VT) with ancestors filled.
+static inline Exception_vt *sjExceptionClass(void *vt) {
+  Exception_vt *evt = vt;
+
+  if (__atomic_load_n(&evt->linked, __ATOMIC_ACQUIRE) != evt) {
+    sjLinkException(evt);
+  }
+
+  return evt;
+}
+
+// Returns non-zero if obj (an Exception) is of class vt or its subclass.
+// Both VTs must have been through sjExceptionClass(), which exobj() and
+// catchclass do.
+static inline int sjIsException(const void *obj, const void *vt) {
+  const Exception_vt *ovt = ((const Exception *) obj)->vt;
+  const Exception_vt *cvt = vt;
+  return ovt->depth >= cvt->depth && ovt->ancestors[cvt->depth] == cvt;
+}
+
+// extraDel of exobj() entries; calls the object's del().
+void sjDelException(void *obj);
+
+// Returns the object of the current exception (see sxCurrentException())
+// or NULL if it wasn't made by exobj().
+static inline Exception *sjCurrentObject(void) {
+  const struct SxTraceEntry *e = sxCurrentExceptionPtr();
+  return e && e->extraDel == sjDelException ? e->extra : NULL;
+}
+
+// Returns the current exception's object if it's of class vt (or its
+// subclass), else NULL.
+static inline void *sjCurrentClass(void *vt) {
+  Exception *obj = sjCurrentObject();
+  return obj && sjIsException(obj, sjExceptionClass(vt)) ? obj : NULL;
+}
+
+// Links vt, then constructs an object of it in entry's payload. If ctor throws
+// or fails, the payload is released and an exception is thrown.
+struct SxTraceEntry sjException(struct SxTraceEntry entry, ctor_t *ctor,
+    void *vt, size_t size, void *params);
+
+#define exobj(class, m) \
+  exobjx(class, m, NULL)
+
+#define exobjx(class, m, params) \
+  sjException(msgex(m), (ctor_t *) &C_new(class), _sjExceptionVt(class), \
+    sizeof(class), params)
+
+// The code is compared first so that exceptions without objects cost the same
+// as with catch(n).
+#define catchclass(class) \
+  else if (_sxMarkSite(_sxSite, hasCatch) && \
+           _sxLastJumpCode == SJ_EXCEPTION && \
+           sjCurrentClass(_sjExceptionVt(class)) && _sxSetCaught(0))
+
+#define curobj(class) \
+  ((class *) sjCurrentClass(_sjExceptionVt(class)))
+
+// Fails to compile unless class extends Exception.
+#define _sjExceptionVt(class) \
+  ((void) sizeof(((class *) 0)->C_(Exception)), vtC(class)())
+
 /*** Other Macros And Functions **********************************************/
 
 #ifdef SJ_OBJECT_MAGIC
@@ -647,6 +798,9 @@ extern _Atomic unsigned sjObjectsDeleted;
 #define newsobj(class, var) \
   newsobjx(class, var, NULL)
 
+// The destructor is an sxDefer() record rather than a try..finally so that
+// it costs no setjmp(). Hence the restrictions in the header: it needs an
+// enclosing try to run on an exception and no 'return' may leave the block.
 #define newsobjx(class, var, params) \
   { \
     class C_(var) = {}; \
@@ -654,17 +808,13 @@ extern _Atomic unsigned sjObjectsDeleted;
     if (var != C_new(class)(var, params)) { \
       sxThrow(msgex("An Autoref object (" #class ") didn't use stack memory.")); \
     } \
-    try {
+    const int C_(var ## Defers) = sxDeferDepth(); \
+    sxDefer(sjDelStack, var); \
+    {
 //
 #define endsobj(var) \
-    } finally { \
-      if (!sjRelease(var)) { \
-        sxThrow(sxprintf(newex(), \
-          "A %s object created on stack cannot be released (holding Autoref?).", \
-          var->vt->className)); \
-      } \
-      var->vt->del(var); \
-    } endtry \
+    } \
+    sxUndefer(C_(var ## Defers), 1); \
   }
 
 #define newobj(class) \
@@ -688,6 +838,9 @@ void *sjNew(ctor_t *ctor, void *params, size_t size,
 // returns non-zero if it returns 1 (i.e. if last ref was decremented).
 char sjRelease(void *obj);
 
+// Calls obj's destructor (for newsobj), throws if it can't be released.
+void sjDelStack(void *obj);
+
 // Returns non-zero when obj was freed (it doesn't always happen for Autoref's).
 char sjDel(void *obj, const char* file, int line);
 